@@ -0,0 +1,56 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "level.h"
+#include "baked_rows.h"
+#include "utility.h"
+
+extern const unsigned char level_data_test0[15182];
+extern const unsigned char level_data_test2[6278];
+
+// Bakes the row display lists of a test level (see source/baked_rows.h)
+// into a file for the cart build's data directory:
+//
+//     roads_bake test2 ../data/test2_rows.bin
+int main(int argc, char** argv) {
+    using namespace roads;
+
+    struct {
+        char const* name;
+        unsigned char const* data;
+        size_t size;
+    } const levels[] = {
+        { "test0", level_data_test0, countof(level_data_test0) },
+        { "test2", level_data_test2, countof(level_data_test2) },
+    };
+
+    if(argc == 3) {
+        for(auto const& l : levels) {
+            if(std::strcmp(argv[1], l.name) != 0)
+                continue;
+
+            level lvl { make_grid(l.data, l.size) };
+            std::vector<uint32_t> words;
+            bake_rows(lvl, l.data, l.size, words);
+
+            FILE* const f = std::fopen(argv[2], "wb");
+            if(!f) {
+                std::perror(argv[2]);
+                return 1;
+            }
+            bool const ok = std::fwrite(&words[0], 4, words.size(), f) == words.size();
+            if(std::fclose(f) != 0 || !ok) {
+                std::perror(argv[2]);
+                return 1;
+            }
+
+            std::printf("%s: %u rows, %u bytes\n", argv[2],
+                unsigned(lvl.grid.size()), unsigned(words.size() * 4));
+            return 0;
+        }
+    }
+
+    std::fprintf(stderr, "usage: %s test0|test2 output\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,52 @@
+#ifndef ROADS_HOST_BENCH_H
+#define ROADS_HOST_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+#include <stdint.h>
+
+namespace roads
+{
+    namespace bench
+    {
+        // Keeps the optimizer from discarding the work being measured.
+        extern volatile uint32_t sink;
+
+        // Calls f repeatedly for roughly a quarter of a second and prints
+        // the average time per call. If each call processes several items
+        // (rows, quads, ...) pass their count to also get the time per item.
+        template <typename F>
+        void run(char const* name, F f, unsigned items_per_call = 1)
+        {
+            typedef std::chrono::steady_clock clock;
+            auto const budget = std::chrono::milliseconds(250);
+
+            f(); // warm up caches and pools
+
+            unsigned long calls = 0;
+            auto const start = clock::now();
+            auto now = start;
+            do {
+                for(unsigned i = 0; i < 16; ++i)
+                    f();
+                calls += 16;
+                now = clock::now();
+            } while(now - start < budget);
+
+            double const ns = std::chrono::duration<double, std::nano>(now - start).count();
+            double const per_call = ns / calls;
+            std::printf("%-40s %12.1f ns/call", name, per_call);
+            if(items_per_call > 1)
+                std::printf(" %10.1f ns/item", per_call / items_per_call);
+            std::printf("\n");
+        }
+
+        // Prints a single measured quantity such as a word count.
+        inline void report(char const* name, double value, char const* unit)
+        {
+            std::printf("%-40s %12.0f %s\n", name, value, unit);
+        }
+    }
+}
+
+#endif // ROADS_HOST_BENCH_H
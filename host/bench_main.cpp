@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <vector>
+
+#include "bench.h"
+#include "gx_interpreter.h"
+#include "level.h"
+#include "baked_rows.h"
+#include "collide.h"
+#include "disp_writer.h"
+#include "geometry.h"
+#include "utility.h"
+
+extern const unsigned char level_data_test0[15182];
+extern const unsigned char level_data_test2[6278];
+
+namespace roads
+{
+    namespace bench
+    {
+        volatile uint32_t sink;
+
+        namespace
+        {
+            void bench_writer() {
+                uint32_t buf[4096];
+                f16 const s = geometry::draw::block_size;
+
+                run("disp_writer: 256 quads", [&] {
+                    disp_writer writer(buf, buf + countof(buf), { 0, 0, 0 }, geometry::draw::scale);
+                    for(int i = 0; i < 256; ++i) {
+                        writer
+                            << normal { { 0, 1, 0 } }
+                            << quad { { 0, 0, 0 }, { s, 0, 0 }, { s, s, 0 }, { 0, s, 0 } };
+                    }
+                    writer << end;
+                    sink = writer.write_count();
+                }, 256);
+
+                run("disp_writer: 256 quads, counting sink", [&] {
+                    counting_disp_writer writer(counting_sink(), { 0, 0, 0 }, geometry::draw::scale);
+                    for(int i = 0; i < 256; ++i) {
+                        writer
+                            << normal { { 0, 1, 0 } }
+                            << quad { { 0, 0, 0 }, { s, 0, 0 }, { s, s, 0 }, { 0, s, 0 } };
+                    }
+                    writer << end;
+                    sink = writer.write_count();
+                }, 256);
+
+                run("disp_writer: 256 quads, null sink", [&] {
+                    null_disp_writer writer(null_sink(), { 0, 0, 0 }, geometry::draw::scale);
+                    for(int i = 0; i < 256; ++i) {
+                        writer
+                            << normal { { 0, 1, 0 } }
+                            << quad { { 0, 0, 0 }, { s, 0, 0 }, { s, s, 0 }, { 0, s, 0 } };
+                    }
+                    writer << end;
+                    sink = writer.get_pipe_index();
+                }, 256);
+            }
+
+            // Plays the level through the geometry engine model and reports
+            // the worst frame, as a fraction of the hardware limits.
+            void report_frames(level& lvl) {
+                host::gx_interpreter gx;
+                gx.set_projection(
+                    host::gx_matrix::look_at(0.0, 0.16, 0.19, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0)
+                    * host::gx_matrix::perspective(70, 256.0 / 192.0, 0.1, 40));
+                gx.attach();
+
+                host::gx_stats worst = host::gx_stats();
+                uint32_t transfers = 0, flushes = 0;
+                lvl.reset();
+                for(size_t row = 0; row < lvl.grid.size(); ++row) {
+                    f32 const z = -f32(geometry::draw::block_size) * int32_t(row);
+                    gx.set_position(host::gx_matrix::translation(0, 0, -raw(z)));
+                    gx.begin_frame();
+                    lvl.update(clamp(f32(0.3) + z, f32(INT_MIN, raw_tag), f32(0)));
+                    host::reset_stats();
+                    lvl.draw();
+                    transfers = std::max(transfers, host::dma.transfers);
+                    flushes = std::max(flushes, host::dcache.flush_calls);
+                    host::gx_stats const& s = gx.totals();
+                    worst.submitted_polygons = std::max(worst.submitted_polygons, s.submitted_polygons);
+                    worst.polygons = std::max(worst.polygons, s.polygons);
+                    worst.vertices = std::max(worst.vertices, s.vertices);
+                }
+                gx.detach();
+                lvl.reset();
+
+                report("worst frame: submitted polygons", worst.submitted_polygons, "polygons");
+                report("worst frame: polygon RAM", worst.polygons, "polygons");
+                report("worst frame: vertex RAM", worst.vertices, "vertices");
+                report("worst frame: DMA transfers", transfers, "transfers");
+                report("worst frame: cache flushes", flushes, "flushes");
+            }
+
+            // What merge_runs and face culling save: the size of all the row
+            // lists and the worst frame of a full run, with each of them
+            // added in turn.
+            void report_savings(unsigned char const* data, size_t size) {
+                struct {
+                    char const* name;
+                    bool merge, cull, away;
+                } const configs[] = {
+                    { "unmerged", false, false, false },
+                    { "merged", true, false, false },
+                    { "merged+culled", true, true, false },
+                    { "merged+culled+away", true, true, true },
+                };
+
+                for(auto const& config : configs) {
+                    level lvl { make_grid(data, size, config.merge) };
+                    lvl.cull_hidden = config.cull;
+                    lvl.cull_facing_away = config.away;
+                    size_t words = 0, polygons = 0, worst = 0;
+                    for(auto row = lvl.grid.begin(); row != lvl.grid.end(); ++row) {
+                        display_row const r = lvl.generate_row_display_list(row);
+                        words += r.data.size();
+                        polygons += r.geometry.polygons();
+                    }
+                    for(size_t row = 0; row < lvl.grid.size(); ++row) {
+                        f32 const z = -f32(geometry::draw::block_size) * int32_t(row);
+                        lvl.update(clamp(f32(0.3) + z, f32(INT_MIN, raw_tag), f32(0)));
+                        frame_budget unlimited;
+                        lvl.link(unlimited);
+                        worst = std::max(worst, unlimited.used.polygons());
+                    }
+
+                    char name[64];
+                    std::snprintf(name, sizeof name, "%s: row lists", config.name);
+                    report(name, words, "words");
+                    std::snprintf(name, sizeof name, "%s: row polygons", config.name);
+                    report(name, polygons, "polygons");
+                    std::snprintf(name, sizeof name, "%s: worst frame", config.name);
+                    report(name, worst, "polygons");
+                }
+            }
+
+            void bench_level(char const* name, unsigned char const* data, size_t size) {
+                level lvl { make_grid(data, size) };
+                size_t const rows = lvl.grid.size();
+
+                size_t words = 0;
+                for(auto row = lvl.grid.begin(); row != lvl.grid.end(); ++row)
+                    words += lvl.generate_row_display_list(row).data.size();
+
+                std::printf("-- %s (%u rows)\n", name, unsigned(rows));
+                report_savings(data, size);
+                report("row lists: total size", words, "words");
+                report_frames(lvl);
+
+                run("generate_row_display_list: all rows", [&] {
+                    for(auto row = lvl.grid.begin(); row != lvl.grid.end(); ++row) {
+                        sink = lvl.generate_row_display_list(row).data.size();
+                    }
+                }, rows);
+
+                std::vector<uint32_t> file;
+                bake_rows(lvl, data, size, file);
+                baked_rows baked;
+                baked.load(&file[0], file.size() * 4, data, size);
+                report("baked rows: file size", file.size() * 4, "bytes");
+                lvl.use_baked(&baked);
+                run("generate_row_display_list: all rows, baked", [&] {
+                    for(auto row = lvl.grid.begin(); row != lvl.grid.end(); ++row) {
+                        sink = lvl.generate_row_display_list(row).data.size();
+                    }
+                }, rows);
+                lvl.use_baked(0);
+
+                run("draw_cell: all rows, buffer sink", [&] {
+                    static uint32_t buf[8192];
+                    for(auto row = lvl.grid.begin(); row != lvl.grid.end(); ++row) {
+                        disp_writer writer(buf, buf + countof(buf), { 0, 0, 0 }, geometry::draw::scale);
+                        vector3f16 offset { 0, 0, 0 };
+                        for(size_t i = 0; i < row->size(); ++i, offset.x += geometry::draw::block_size) {
+                            if((*row)[i].depth > 0)
+                                writer << draw_cell { (*row)[i].data, offset, { 1, 1, (*row)[i].depth } };
+                        }
+                        writer << end;
+                        sink = writer.write_count();
+                    }
+                }, rows);
+
+                auto const full_run = [&] {
+                    lvl.reset();
+                    for(size_t z = 0; z < rows; ++z) {
+                        lvl.update(-f32(geometry::draw::block_size) * int32_t(z));
+                        lvl.draw();
+                    }
+                };
+                run("level::update+draw: full run", full_run, rows);
+
+                // A row ahead and back again at each step, so that rows keep
+                // leaving the window and coming back.
+                run("level::update+draw: back and forth", [&] {
+                    lvl.reset();
+                    for(size_t z = 0; z + 1 < rows; ++z) {
+                        lvl.update(-f32(geometry::draw::block_size) * int32_t(z + 1));
+                        lvl.draw();
+                        lvl.update(-f32(geometry::draw::block_size) * int32_t(z));
+                        lvl.draw();
+                    }
+                }, 2 * (rows - 1));
+
+                command_slab::statistics const& slab = lvl.row_slab.stats();
+                report("row slab: peak live", slab.peak_live_words, "words");
+                report("row slab: peak resident", slab.peak_resident_words, "words");
+                report("row slab: resident after run", slab.resident_words, "words");
+
+                // The same with the frame written through the uncached
+                // mirror, which the host doesn't have, so what differs is
+                // what the DS would have to flush.
+                lvl.frame.set_uncached(true);
+                run("level::update+draw: uncached frame", full_run, rows);
+                host::reset_stats();
+                full_run();
+                report("uncached frame: flushed per frame", double(host::dcache.flushed_bytes) / rows, "bytes");
+                lvl.frame.set_uncached(false);
+                host::reset_stats();
+                full_run();
+                report("cached frame: flushed per frame", double(host::dcache.flushed_bytes) / rows, "bytes");
+
+                run("collide: ship sweep along centre", [&] {
+                    vector3f32 const velocity { 0, 0, -f32(0.01) };
+                    vector3f32 position {
+                        geometry::draw::ship_size.x * f32(-0.5),
+                        geometry::draw::tile_height * 5,
+                        0 };
+                    for(size_t z = 0; z < rows; ++z, position.z -= f32(geometry::draw::block_size)) {
+                        sink = collide(position, velocity, lvl.grid).which();
+                    }
+                }, rows);
+            }
+        }
+    }
+}
+
+int main() {
+    using namespace roads;
+    using namespace roads::bench;
+
+    bench_writer();
+    bench_level("test0", level_data_test0, countof(level_data_test0));
+    bench_level("test2", level_data_test2, countof(level_data_test2));
+
+    return 0;
+}
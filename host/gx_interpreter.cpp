@@ -0,0 +1,540 @@
+#include "gx_interpreter.h"
+
+#include <algorithm>
+#include <cmath>
+#include "roads_host.h"
+#include "command_stream.h"
+
+namespace roads
+{
+    namespace host
+    {
+        namespace
+        {
+            // Command ids as packed by fifo_pack, see glcore.h.
+            enum
+            {
+                cmd_mtx_mode     = 0x10,
+                cmd_mtx_push     = 0x11,
+                cmd_mtx_pop      = 0x12,
+                cmd_mtx_store    = 0x13,
+                cmd_mtx_restore  = 0x14,
+                cmd_mtx_identity = 0x15,
+                cmd_mtx_load_4x4 = 0x16,
+                cmd_mtx_load_4x3 = 0x17,
+                cmd_mtx_mult_4x4 = 0x18,
+                cmd_mtx_mult_4x3 = 0x19,
+                cmd_mtx_mult_3x3 = 0x1a,
+                cmd_mtx_scale    = 0x1b,
+                cmd_mtx_trans    = 0x1c,
+                cmd_vtx_16       = 0x23,
+                cmd_vtx_10       = 0x24,
+                cmd_vtx_xy       = 0x25,
+                cmd_vtx_xz       = 0x26,
+                cmd_vtx_yz       = 0x27,
+                cmd_vtx_diff     = 0x28,
+                cmd_begin_vtxs   = 0x40
+            };
+
+            enum { mode_projection = 0, mode_position = 1, mode_position_vector = 2, mode_texture = 3 };
+            enum { prim_triangles = 0, prim_quads = 1, prim_triangle_strip = 2, prim_quad_strip = 3 };
+
+            int32_t to_fixed(double d)
+            {
+                return int32_t(std::floor(d * 4096 + 0.5));
+            }
+
+            // Sign-extends the lowest `bits` bits of value.
+            int32_t sign_extend(uint32_t value, unsigned bits)
+            {
+                return int32_t(value << (32 - bits)) >> (32 - bits);
+            }
+
+            gx_matrix from_params(uint32_t const* params, size_t rows, size_t cols)
+            {
+                gx_matrix m = gx_matrix::identity();
+                for(size_t r = 0; r < rows; ++r)
+                    for(size_t c = 0; c < cols; ++c)
+                        m.m[r * 4 + c] = int32_t(*params++);
+                return m;
+            }
+
+            // Signed area of the polygon after perspective division; positive
+            // means counter-clockwise on screen, i.e. front facing.
+            template <typename Vertex>
+            double screen_area(Vertex const* v, size_t count)
+            {
+                double area = 0;
+                for(size_t i = 0; i < count; ++i) {
+                    Vertex const& a = v[i];
+                    Vertex const& b = v[(i + 1) % count];
+                    area += (a.x / a.w) * (b.y / b.w) - (b.x / b.w) * (a.y / a.w);
+                }
+                return area;
+            }
+        }
+
+        gx_stats& gx_stats::operator+=(gx_stats const& rhs)
+        {
+            packs += rhs.packs;
+            commands += rhs.commands;
+            submitted_vertices += rhs.submitted_vertices;
+            submitted_polygons += rhs.submitted_polygons;
+            culled_polygons += rhs.culled_polygons;
+            rejected_polygons += rhs.rejected_polygons;
+            clipped_polygons += rhs.clipped_polygons;
+            polygons += rhs.polygons;
+            vertices += rhs.vertices;
+            max_stack_depth = std::max(max_stack_depth, rhs.max_stack_depth);
+            stack_errors += rhs.stack_errors;
+            decode_errors += rhs.decode_errors;
+            return *this;
+        }
+
+        gx_matrix gx_matrix::identity()
+        {
+            gx_matrix r = {{ 4096, 0, 0, 0,  0, 4096, 0, 0,  0, 0, 4096, 0,  0, 0, 0, 4096 }};
+            return r;
+        }
+
+        gx_matrix gx_matrix::translation(int32_t x, int32_t y, int32_t z)
+        {
+            gx_matrix r = identity();
+            r.m[12] = x;
+            r.m[13] = y;
+            r.m[14] = z;
+            return r;
+        }
+
+        gx_matrix gx_matrix::perspective(double fovy, double aspect, double near, double far)
+        {
+            double const f = 1 / std::tan(fovy * M_PI / 360);
+            gx_matrix r = {{ 0 }};
+            r.m[0] = to_fixed(f / aspect);
+            r.m[5] = to_fixed(f);
+            r.m[10] = to_fixed((far + near) / (near - far));
+            r.m[11] = to_fixed(-1);
+            r.m[14] = to_fixed(2 * far * near / (near - far));
+            return r;
+        }
+
+        gx_matrix gx_matrix::look_at(double ex, double ey, double ez,
+                                     double cx, double cy, double cz,
+                                     double ux, double uy, double uz)
+        {
+            double fx = cx - ex, fy = cy - ey, fz = cz - ez;
+            double const fl = std::sqrt(fx * fx + fy * fy + fz * fz);
+            fx /= fl; fy /= fl; fz /= fl;
+
+            // side = forward x up
+            double sx = fy * uz - fz * uy, sy = fz * ux - fx * uz, sz = fx * uy - fy * ux;
+            double const sl = std::sqrt(sx * sx + sy * sy + sz * sz);
+            sx /= sl; sy /= sl; sz /= sl;
+
+            // up = side x forward
+            double const vx = sy * fz - sz * fy, vy = sz * fx - sx * fz, vz = sx * fy - sy * fx;
+
+            gx_matrix r = identity();
+            r.m[0] = to_fixed(sx); r.m[1] = to_fixed(vx); r.m[2]  = to_fixed(-fx);
+            r.m[4] = to_fixed(sy); r.m[5] = to_fixed(vy); r.m[6]  = to_fixed(-fy);
+            r.m[8] = to_fixed(sz); r.m[9] = to_fixed(vz); r.m[10] = to_fixed(-fz);
+            r.m[12] = to_fixed(-(sx * ex + sy * ey + sz * ez));
+            r.m[13] = to_fixed(-(vx * ex + vy * ey + vz * ez));
+            r.m[14] = to_fixed(fx * ex + fy * ey + fz * ez);
+            return r;
+        }
+
+        gx_matrix operator*(gx_matrix const& a, gx_matrix const& b)
+        {
+            gx_matrix r;
+            for(size_t i = 0; i < 4; ++i) {
+                for(size_t j = 0; j < 4; ++j) {
+                    int64_t sum = 0;
+                    for(size_t k = 0; k < 4; ++k)
+                        sum += int64_t(a.m[i * 4 + k]) * b.m[k * 4 + j];
+                    r.m[i * 4 + j] = int32_t(sum >> 12);
+                }
+            }
+            return r;
+        }
+
+        gx_interpreter::gx_interpreter()
+            : projection(gx_matrix::identity()), projection_saved(gx_matrix::identity()),
+              position(gx_matrix::identity()), stack(), stack_pointer(0),
+              matrix_mode(mode_position_vector), projection_pushed(false),
+              cull_back(true), cull_front(false),
+              current(), primitive(prim_triangles), strip(), strip_count(0), strip_shared(false),
+              list(), frame()
+        {
+        }
+
+        void gx_interpreter::begin_frame()
+        {
+            frame = gx_stats();
+        }
+
+        gx_stats gx_interpreter::execute(uint32_t const* words, size_t count)
+        {
+            list = gx_stats();
+            list.max_stack_depth = stack_pointer;
+
+            size_t i = 0;
+            while(i < count) {
+                uint32_t const pack = words[i++];
+                ++list.packs;
+                // a zero word where a header is expected is just an empty one
+                if(pack == 0)
+                    continue;
+
+                for(unsigned slot = 0; slot < 4; ++slot) {
+                    uint8_t const id = (pack >> (slot * 8)) & 0xFF;
+                    // Nops padding a header get a zero parameter, so that
+                    // the top-most command always has parameters.
+                    if(id == 0) {
+                        if(i >= count || words[i] != 0) {
+                            ++list.decode_errors;
+                            i = count;
+                            break;
+                        }
+                        ++i;
+                        continue;
+                    }
+
+                    int const params = gx_param_count(id);
+                    if(params < 0 || i + params > count || (slot == 3 && params == 0)) {
+                        ++list.decode_errors;
+                        i = count;
+                        break;
+                    }
+
+                    command(id, words + i);
+                    i += params;
+                    ++list.commands;
+                }
+            }
+
+            frame += list;
+            return list;
+        }
+
+        namespace
+        {
+            void fifo_sink(uint32_t const* words, size_t count, void* user)
+            {
+                static_cast<gx_interpreter*>(user)->execute(words, count);
+            }
+        }
+
+        void gx_interpreter::attach()
+        {
+            set_gx_fifo_sink(fifo_sink, this);
+        }
+
+        void gx_interpreter::detach()
+        {
+            set_gx_fifo_sink(0, 0);
+        }
+
+        void gx_interpreter::matrix_load(gx_matrix const& m)
+        {
+            if(matrix_mode == mode_projection)
+                projection = m;
+            else if(matrix_mode != mode_texture)
+                position = m;
+        }
+
+        void gx_interpreter::matrix_mult(gx_matrix const& m)
+        {
+            if(matrix_mode == mode_projection)
+                projection = m * projection;
+            else if(matrix_mode != mode_texture)
+                position = m * position;
+        }
+
+        void gx_interpreter::command(uint8_t id, uint32_t const* params)
+        {
+            switch(id) {
+            case cmd_mtx_mode:
+                matrix_mode = params[0] & 3;
+                break;
+
+            case cmd_mtx_push:
+                if(matrix_mode == mode_projection) {
+                    if(projection_pushed)
+                        ++list.stack_errors;
+                    projection_saved = projection;
+                    projection_pushed = true;
+                }
+                else if(matrix_mode != mode_texture) {
+                    if(stack_pointer >= stack_size) {
+                        ++list.stack_errors;
+                        break;
+                    }
+                    stack[stack_pointer++] = position;
+                    list.max_stack_depth = std::max(list.max_stack_depth, stack_pointer);
+                }
+                break;
+
+            case cmd_mtx_pop:
+                if(matrix_mode == mode_projection) {
+                    if(!projection_pushed)
+                        ++list.stack_errors;
+                    projection = projection_saved;
+                    projection_pushed = false;
+                }
+                else if(matrix_mode != mode_texture) {
+                    int32_t const n = sign_extend(params[0], 6);
+                    int32_t const sp = int32_t(stack_pointer) - n;
+                    if(sp < 0 || sp >= stack_size) {
+                        ++list.stack_errors;
+                        break;
+                    }
+                    stack_pointer = sp;
+                    position = stack[stack_pointer];
+                }
+                break;
+
+            case cmd_mtx_store:
+                if(matrix_mode != mode_projection && matrix_mode != mode_texture)
+                    stack[std::min<uint32_t>(params[0] & 0x1F, stack_size - 1)] = position;
+                break;
+
+            case cmd_mtx_restore:
+                if(matrix_mode != mode_projection && matrix_mode != mode_texture)
+                    position = stack[std::min<uint32_t>(params[0] & 0x1F, stack_size - 1)];
+                break;
+
+            case cmd_mtx_identity: matrix_load(gx_matrix::identity()); break;
+            case cmd_mtx_load_4x4: matrix_load(from_params(params, 4, 4)); break;
+            case cmd_mtx_load_4x3: matrix_load(from_params(params, 4, 3)); break;
+            case cmd_mtx_mult_4x4: matrix_mult(from_params(params, 4, 4)); break;
+            case cmd_mtx_mult_4x3: matrix_mult(from_params(params, 4, 3)); break;
+            case cmd_mtx_mult_3x3: matrix_mult(from_params(params, 3, 3)); break;
+
+            case cmd_mtx_scale: {
+                gx_matrix m = gx_matrix::identity();
+                m.m[0] = params[0];
+                m.m[5] = params[1];
+                m.m[10] = params[2];
+                matrix_mult(m);
+                break;
+            }
+
+            case cmd_mtx_trans:
+                matrix_mult(gx_matrix::translation(params[0], params[1], params[2]));
+                break;
+
+            case cmd_vtx_16:
+                current[0] = int16_t(params[0] & 0xFFFF);
+                current[1] = int16_t(params[0] >> 16);
+                current[2] = int16_t(params[1] & 0xFFFF);
+                emit_vertex();
+                break;
+
+            case cmd_vtx_10:
+                current[0] = int16_t((params[0] & 0x3FF) << 6);
+                current[1] = int16_t(((params[0] >> 10) & 0x3FF) << 6);
+                current[2] = int16_t(((params[0] >> 20) & 0x3FF) << 6);
+                emit_vertex();
+                break;
+
+            case cmd_vtx_xy:
+                current[0] = int16_t(params[0] & 0xFFFF);
+                current[1] = int16_t(params[0] >> 16);
+                emit_vertex();
+                break;
+
+            case cmd_vtx_xz:
+                current[0] = int16_t(params[0] & 0xFFFF);
+                current[2] = int16_t(params[0] >> 16);
+                emit_vertex();
+                break;
+
+            case cmd_vtx_yz:
+                current[1] = int16_t(params[0] & 0xFFFF);
+                current[2] = int16_t(params[0] >> 16);
+                emit_vertex();
+                break;
+
+            case cmd_vtx_diff:
+                current[0] = int16_t(current[0] + sign_extend(params[0], 10));
+                current[1] = int16_t(current[1] + sign_extend(params[0] >> 10, 10));
+                current[2] = int16_t(current[2] + sign_extend(params[0] >> 20, 10));
+                emit_vertex();
+                break;
+
+            case cmd_begin_vtxs:
+                primitive = params[0] & 3;
+                strip_count = 0;
+                strip_shared = false;
+                break;
+
+            default:
+                // Material, lighting and other state doesn't affect how much
+                // polygon and vertex RAM is used.
+                break;
+            }
+        }
+
+        void gx_interpreter::emit_vertex()
+        {
+            ++list.submitted_vertices;
+
+            // (x, y, z, 1) * position * projection
+            int64_t p[4];
+            for(size_t j = 0; j < 4; ++j) {
+                p[j] = (int64_t(current[0]) * position.m[j]
+                      + int64_t(current[1]) * position.m[4 + j]
+                      + int64_t(current[2]) * position.m[8 + j]) / 4096
+                      + position.m[12 + j];
+            }
+            double c[4];
+            for(size_t j = 0; j < 4; ++j) {
+                int64_t const sum = p[0] * projection.m[j] + p[1] * projection.m[4 + j]
+                                  + p[2] * projection.m[8 + j] + p[3] * projection.m[12 + j];
+                c[j] = double(sum / 4096) / 4096;
+            }
+
+            vertex const v = { c[0], c[1], c[2], c[3] };
+
+            switch(primitive) {
+            case prim_triangles:
+                strip[strip_count++] = v;
+                if(strip_count == 3) {
+                    emit_polygon(strip, 3, 0);
+                    strip_count = 0;
+                }
+                break;
+
+            case prim_quads:
+                strip[strip_count++] = v;
+                if(strip_count == 4) {
+                    emit_polygon(strip, 4, 0);
+                    strip_count = 0;
+                }
+                break;
+
+            case prim_triangle_strip:
+                if(strip_count < 3) {
+                    strip[strip_count++] = v;
+                }
+                else {
+                    strip[0] = strip[1];
+                    strip[1] = strip[2];
+                    strip[2] = v;
+                    ++strip_count;
+                }
+                if(strip_count >= 3) {
+                    // every other triangle in a strip has reversed winding
+                    if(strip_count % 2 == 0) {
+                        vertex const tri[3] = { strip[1], strip[0], strip[2] };
+                        emit_polygon(tri, 3, 2);
+                    }
+                    else {
+                        emit_polygon(strip, 3, 2);
+                    }
+                }
+                break;
+
+            case prim_quad_strip:
+                strip[strip_count++] = v;
+                if(strip_count == 4) {
+                    vertex const quad[4] = { strip[0], strip[1], strip[3], strip[2] };
+                    emit_polygon(quad, 4, 2);
+                    strip[0] = strip[2];
+                    strip[1] = strip[3];
+                    strip_count = 2;
+                }
+                break;
+            }
+        }
+
+        void gx_interpreter::emit_polygon(vertex const* v, size_t count, size_t shared)
+        {
+            ++list.submitted_polygons;
+
+            // Outcodes against the six planes of the view volume.
+            unsigned all_out = 0x3F, any_out = 0;
+            for(size_t i = 0; i < count; ++i) {
+                unsigned code = 0;
+                if(v[i].x < -v[i].w) code |= 0x01;
+                if(v[i].x >  v[i].w) code |= 0x02;
+                if(v[i].y < -v[i].w) code |= 0x04;
+                if(v[i].y >  v[i].w) code |= 0x08;
+                if(v[i].z < -v[i].w) code |= 0x10;
+                if(v[i].z >  v[i].w) code |= 0x20;
+                all_out &= code;
+                any_out |= code;
+            }
+
+            if(all_out) {
+                ++list.rejected_polygons;
+                strip_shared = false;
+                return;
+            }
+
+            // Sutherland-Hodgman against each plane the polygon crosses. A
+            // convex polygon gains at most one vertex per plane.
+            vertex buf[2][10];
+            size_t n = count;
+            std::copy(v, v + count, buf[0]);
+            vertex* in = buf[0];
+            vertex* out = buf[1];
+
+            for(unsigned plane = 0; plane < 6; ++plane) {
+                if(!(any_out & (1u << plane)))
+                    continue;
+
+                unsigned const axis = plane / 2;
+                double const sign = (plane % 2) ? 1 : -1;
+                auto dist = [&](vertex const& p) {
+                    double const coord = axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+                    return p.w - sign * coord; // >= 0 means inside
+                };
+
+                size_t m = 0;
+                for(size_t i = 0; i < n; ++i) {
+                    vertex const& a = in[i];
+                    vertex const& b = in[(i + 1) % n];
+                    double const da = dist(a), db = dist(b);
+                    if(da >= 0)
+                        out[m++] = a;
+                    if((da >= 0) != (db >= 0)) {
+                        double const t = da / (da - db);
+                        vertex const c = {
+                            a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t,
+                            a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+                        out[m++] = c;
+                    }
+                }
+                std::swap(in, out);
+                n = m;
+            }
+
+            if(n < 3) {
+                ++list.rejected_polygons;
+                strip_shared = false;
+                return;
+            }
+
+            double const area = screen_area(in, n);
+            if((area < 0 && cull_back) || (area > 0 && cull_front)) {
+                ++list.culled_polygons;
+                strip_shared = false;
+                return;
+            }
+
+            ++list.polygons;
+            if(any_out) {
+                // Clipped polygons get their own copies of every vertex.
+                ++list.clipped_polygons;
+                list.vertices += n;
+                strip_shared = false;
+            }
+            else {
+                list.vertices += strip_shared ? count - shared : count;
+                strip_shared = true;
+            }
+        }
+    }
+}
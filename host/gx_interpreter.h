@@ -0,0 +1,140 @@
+#ifndef ROADS_HOST_GX_INTERPRETER_H
+#define ROADS_HOST_GX_INTERPRETER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace roads
+{
+    namespace host
+    {
+        // Per-frame capacities of the geometry engine's polygon and vertex
+        // RAM. Anything submitted beyond these silently disappears on the
+        // hardware.
+        enum
+        {
+            gx_max_polygons = 2048,
+            gx_max_vertices = 6144
+        };
+
+        struct gx_stats
+        {
+            size_t packs;              // packed command words decoded
+            size_t commands;           // commands executed, not counting nops
+            size_t submitted_vertices; // vertex commands
+            size_t submitted_polygons; // polygons formed by those vertices
+            size_t culled_polygons;    // rejected as back facing
+            size_t rejected_polygons;  // entirely outside the view volume
+            size_t clipped_polygons;   // crossing the view volume, clipped
+            size_t polygons;           // polygons written to polygon RAM
+            size_t vertices;           // vertices written to vertex RAM
+            size_t max_stack_depth;    // position matrix stack high-water mark
+            size_t stack_errors;       // matrix stack overflows and underflows
+            size_t decode_errors;      // unknown commands, truncated lists, nops
+                                       // without a zero parameter or a
+                                       // parameterless top-most command
+
+            gx_stats& operator+=(gx_stats const& rhs);
+
+            bool fits() const
+            {
+                return polygons <= gx_max_polygons && vertices <= gx_max_vertices;
+            }
+        };
+
+        // 4x4 matrix in 20.12 fixed point, laid out the way the GX loads it:
+        // row-major, multiplied with row vectors, translation in row 3.
+        struct gx_matrix
+        {
+            int32_t m[16];
+
+            static gx_matrix identity();
+
+            // Same conventions as gluPerspective and gluLookAt.
+            static gx_matrix perspective(double fovy, double aspect, double near, double far);
+            static gx_matrix look_at(double ex, double ey, double ez,
+                                     double cx, double cy, double cz,
+                                     double ux, double uy, double uz);
+            static gx_matrix translation(int32_t x, int32_t y, int32_t z);
+        };
+
+        // a * b, as the GX computes it.
+        gx_matrix operator*(gx_matrix const& a, gx_matrix const& b);
+
+        // Software model of the DS geometry engine, detailed enough to say
+        // how much polygon and vertex RAM a display list ends up using. It
+        // decodes the packed command format that disp_writer produces,
+        // tracks the matrix stacks and current vertex, assembles primitives,
+        // culls back faces and clips against the view volume. Lighting,
+        // texturing and rasterization are not modelled.
+        struct gx_interpreter
+        {
+            gx_interpreter();
+
+            // Executes a packed display list and returns the statistics for
+            // that list alone. They are also added to totals().
+            gx_stats execute(uint32_t const* words, size_t count);
+
+            template <typename List>
+            gx_stats execute(List const& list)
+            {
+                return execute(list.empty() ? 0 : &*list.begin(), list.size());
+            }
+
+            // Makes every display_list::draw (i.e. every DMA into the GX
+            // FIFO) run through this interpreter until detach is called.
+            void attach();
+            void detach();
+
+            // Resets the per-frame totals, as the hardware does on a buffer
+            // swap. Matrices are kept.
+            void begin_frame();
+            gx_stats const& totals() const { return frame; }
+
+            // Matrix state outside of the display lists, normally set up
+            // through libnds' gl* calls.
+            void set_projection(gx_matrix const& m) { projection = m; }
+            void set_position(gx_matrix const& m) { position = m; }
+            gx_matrix const& get_position() const { return position; }
+            size_t stack_depth() const { return stack_pointer; }
+            // The current vertex in 4.12, as left by the last vertex command.
+            int16_t const* current_vertex() const { return current; }
+
+            void set_cull_back(bool cull) { cull_back = cull; }
+            void set_cull_front(bool cull) { cull_front = cull; }
+
+        private:
+            enum { stack_size = 31 };
+
+            struct vertex
+            {
+                double x, y, z, w;
+            };
+
+            gx_matrix projection, projection_saved;
+            gx_matrix position;
+            gx_matrix stack[stack_size];
+            size_t stack_pointer;
+            int matrix_mode;
+            bool projection_pushed;
+
+            bool cull_back, cull_front;
+
+            int16_t current[3];
+            int primitive;
+            vertex strip[4];
+            size_t strip_count;
+            bool strip_shared;
+
+            gx_stats list, frame;
+
+            void command(uint8_t id, uint32_t const* params);
+            void matrix_load(gx_matrix const& m);
+            void matrix_mult(gx_matrix const& m);
+            void emit_vertex();
+            void emit_polygon(vertex const* v, size_t count, size_t shared);
+        };
+    }
+}
+
+#endif // ROADS_HOST_GX_INTERPRETER_H
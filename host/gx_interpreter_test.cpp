@@ -0,0 +1,917 @@
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+#include "unit_config.h"
+
+#if RUN_UNIT_TESTS == 1
+
+#include "unit_test.h"
+#include "gx_interpreter.h"
+#include "gx_profile.h"
+#include "disp_writer.h"
+#include "chunk_arena.h"
+#include "level.h"
+#include "dma_queue.h"
+#include "frame_linker.h"
+#include "baked_rows.h"
+#include "geometry.h"
+#include "utility.h"
+
+extern const unsigned char level_data_test0[15182];
+extern const unsigned char level_data_test2[6278];
+
+namespace roads
+{
+    using host::gx_interpreter;
+    using host::gx_matrix;
+    using host::gx_stats;
+
+    namespace
+    {
+        // The projection set up by main.cpp.
+        gx_matrix game_projection() {
+            return gx_matrix::look_at(0.0, 0.16, 0.19, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0)
+                 * gx_matrix::perspective(70, 256.0 / 192.0, 0.1, 40);
+        }
+
+        UNIT_TEST(gx_decode_quad,
+        {
+            uint32_t buf[64];
+            disp_writer writer(buf, buf + countof(buf), { 0, 0, 0 }, { 1, 1, 1 });
+            writer
+                << diffuse_ambient { make_rgb(24, 24, 24), make_rgb(3, 3, 3), true }
+                << normal { { 0, 0, 1 } }
+                << quad { { -0.5, -0.5, 0 }, { 0.5, -0.5, 0 }, { 0.5, 0.5, 0 }, { -0.5, 0.5, 0 } }
+                << end;
+
+            gx_interpreter gx;
+            gx_stats const s = gx.execute(buf, writer.write_count());
+            UASSERT_EQUAL(s.decode_errors, 0);
+            UASSERT_EQUAL(s.commands, 10);
+            UASSERT_EQUAL(s.submitted_vertices, 4);
+            UASSERT_EQUAL(s.polygons, 1);
+            UASSERT_EQUAL(s.vertices, 4);
+            UASSERT_EQUAL(s.max_stack_depth, 1);
+            UASSERT_EQUAL(s.stack_errors, 0);
+            UASSERT_EQUAL(gx.stack_depth(), 0);
+            UASSERT_EQUAL(gx.totals().polygons, 1);
+        });
+
+        UNIT_TEST(gx_cull_and_reject,
+        {
+            uint32_t buf[128];
+            disp_writer writer(buf, buf + countof(buf), { 0, 0, 0 }, { 1, 1, 1 });
+            writer
+                // clockwise, culled
+                << quad { { -0.5, -0.5, 0 }, { -0.5, 0.5, 0 }, { 0.5, 0.5, 0 }, { 0.5, -0.5, 0 } }
+                // off to the right, rejected
+                << quad { { 1.5, -0.5, 0 }, { 2.5, -0.5, 0 }, { 2.5, 0.5, 0 }, { 1.5, 0.5, 0 } }
+                // crossing the right edge, clipped to a quad
+                << tri { { -0.5, -0.5, 0 }, { 2, -0.5, 0 }, { -0.5, 0.5, 0 } }
+                << end;
+
+            gx_interpreter gx;
+            gx_stats const s = gx.execute(buf, writer.write_count());
+            UASSERT_EQUAL(s.submitted_polygons, 3);
+            UASSERT_EQUAL(s.culled_polygons, 1);
+            UASSERT_EQUAL(s.rejected_polygons, 1);
+            UASSERT_EQUAL(s.clipped_polygons, 1);
+            UASSERT_EQUAL(s.polygons, 1);
+            UASSERT_EQUAL(s.vertices, 4);
+        });
+
+        UNIT_TEST(gx_quad_strip_shares_vertices,
+        {
+            uint32_t buf[128];
+            disp_writer writer(buf, buf + countof(buf), { 0, 0, 0 }, { 1, 1, 1 });
+            writer
+                << quad_strip { { -0.5, 0.5, 0 }, { -0.5, -0.5, 0 },
+                                { 0, 0.5, 0 },    { 0, -0.5, 0 },
+                                { 0.5, 0.5, 0 },  { 0.5, -0.5, 0 } }
+                << end;
+
+            gx_interpreter gx;
+            gx_stats const s = gx.execute(buf, writer.write_count());
+            UASSERT_EQUAL(s.polygons, 2);
+            UASSERT_EQUAL(s.culled_polygons, 0);
+            UASSERT_EQUAL(s.vertices, 6);
+        });
+
+        UNIT_TEST(gx_matrix_stack_errors,
+        {
+            uint32_t const underflow[] = {
+                fifo_pack(gfx_matrix_pop, gfx_nop, gfx_nop, gfx_nop), 1, 0, 0, 0
+            };
+            gx_interpreter gx;
+            UASSERT_EQUAL(gx.execute(underflow, countof(underflow)).stack_errors, 1);
+
+            uint32_t const truncated[] = {
+                fifo_pack(gfx_matrix_trans, gfx_nop, gfx_nop, gfx_nop), 0, 0
+            };
+            UASSERT_EQUAL(gx.execute(truncated, countof(truncated)).decode_errors, 1);
+
+            // the top-most command must have parameters, and the nops that
+            // pad a header must have a zero one
+            uint32_t const bare_nops[] = {
+                fifo_pack(gfx_matrix_pop, gfx_nop, gfx_nop, gfx_nop), 1
+            };
+            UASSERT_EQUAL(gx.execute(bare_nops, countof(bare_nops)).decode_errors, 1);
+
+            uint32_t const parameterless_top[] = {
+                fifo_pack(gfx_color, gfx_color, gfx_color, gfx_matrix_push), 0, 0, 0
+            };
+            UASSERT_EQUAL(gx.execute(parameterless_top, countof(parameterless_top)).decode_errors, 1);
+        });
+
+        // Plays each level through the same update/draw sequence as the game
+        // loop, with every display list DMA feeding the interpreter, and
+        // checks that no frame exceeds the hardware's polygon and vertex RAM.
+        void check_level_fits(unsigned char const* data, size_t size) {
+            level lvl { make_grid(data, size) };
+            gx_interpreter gx;
+            gx.set_projection(game_projection());
+            gx.attach();
+
+            int32_t const rows = lvl.grid.size();
+            for(int32_t row = 0; row < rows; ++row) {
+                f32 const z = -f32(geometry::draw::block_size) * row;
+                gx.set_position(gx_matrix::translation(0, 0, -raw(z)));
+                gx.begin_frame();
+                lvl.update(clamp(f32(0.3) + z, f32(INT_MIN, raw_tag), f32(0)));
+                lvl.draw();
+
+                gx_stats const& s = gx.totals();
+                UASSERT(s.decode_errors == 0 && s.stack_errors == 0,
+                    "row %d: %u decode errors, %u stack errors",
+                    int(row), unsigned(s.decode_errors), unsigned(s.stack_errors));
+                UASSERT(gx.stack_depth() == 0, "row %d: matrix stack left at %u", int(row), unsigned(gx.stack_depth()));
+                UASSERT(s.fits(), "row %d: %u polygons, %u vertices",
+                    int(row), unsigned(s.polygons), unsigned(s.vertices));
+            }
+            gx.detach();
+        }
+
+        void collect_words(uint32_t const* words, size_t count, void* user) {
+            std::vector<uint32_t>& out = *static_cast<std::vector<uint32_t>*>(user);
+            out.insert(out.end(), words, words + count);
+        }
+
+        UNIT_TEST(gx_fifo_sink_stream,
+        {
+            // Words streamed through the FIFO port are the same ones the
+            // buffer sink would have stored.
+            std::vector<uint32_t> streamed;
+            host::set_gx_fifo_sink(collect_words, &streamed);
+            fifo_disp_writer direct(fifo_sink(), { 0, 0, 0 }, { 1, 1, 1 });
+            direct
+                << normal { { 0, 0, 1 } }
+                << quad { { -0.5, -0.5, 0 }, { 0.5, -0.5, 0 }, { 0.5, 0.5, 0 }, { -0.5, 0.5, 0 } }
+                << end;
+            host::set_gx_fifo_sink(0, 0);
+
+            uint32_t buf[64];
+            disp_writer writer(buf, buf + countof(buf), { 0, 0, 0 }, { 1, 1, 1 });
+            writer
+                << normal { { 0, 0, 1 } }
+                << quad { { -0.5, -0.5, 0 }, { 0.5, -0.5, 0 }, { 0.5, 0.5, 0 }, { -0.5, 0.5, 0 } }
+                << end;
+
+            UASSERT_EQUAL(direct.write_count(), writer.write_count());
+            UASSERT_EQUAL(streamed.size(), writer.write_count());
+            for(size_t i = 0; i < streamed.size(); ++i) {
+                UASSERT(streamed[i] == buf[i], "[%d] %X != %X", int(i), streamed[i], buf[i]);
+            }
+
+            gx_interpreter gx;
+            UASSERT_EQUAL(gx.execute(streamed).polygons, 1);
+        });
+
+        UNIT_TEST(gx_chunks_stand_alone,
+        {
+            // Every chunk has to decode by itself, since each one is sent to
+            // the FIFO with a DMA of its own.
+            chunk_arena arena;
+            chunk_disp_writer writer(chunk_sink(arena), { 0, 0, -1 }, { 1, 1, 1 });
+            for(int i = 0; i < 200; ++i) {
+                f16 const x = f16(0.001) * i;
+                writer
+                    << normal { { 0, 0, i & 1 ? 1 : -1 } }
+                    << quad { { x, 0, 0 }, { f16(x + f16(0.1)), 0, 0 }, { f16(x + f16(0.1)), 0.1, 0 }, { x, 0.1, 0 } };
+            }
+            writer << end;
+            UASSERT(arena.chunk_count() > 1, "Expected more than one chunk");
+
+            gx_interpreter gx;
+            gx_stats total = gx_stats();
+            for(size_t i = 0; i < arena.chunk_count(); ++i) {
+                gx_stats const s = gx.execute(arena[i].words, arena[i].used);
+                UASSERT_EQUAL(s.decode_errors, 0);
+                total += s;
+            }
+            UASSERT_EQUAL(total.submitted_vertices, 800);
+            UASSERT_EQUAL(gx.stack_depth(), 0);
+        });
+
+        UNIT_TEST(gx_level_test0_fits,
+        {
+            check_level_fits(level_data_test0, countof(level_data_test0));
+        });
+
+        UNIT_TEST(gx_level_test2_fits,
+        {
+            check_level_fits(level_data_test2, countof(level_data_test2));
+        });
+
+        UNIT_TEST(gx_frame_linked,
+        {
+            // Each frame is a single flush and a single DMA, and draws the
+            // same polygons as the rows would, each with a matrix of its
+            // own.
+            level lvl { make_grid(level_data_test0, countof(level_data_test0)) };
+            gx_interpreter gx, separate;
+            gx.set_projection(game_projection());
+            separate.set_projection(game_projection());
+            gx.attach();
+            frame_linker one;
+            for(size_t row = 0; row < lvl.grid.size(); ++row) {
+                f32 const z = -f32(geometry::draw::block_size) * int32_t(row);
+                gx.set_position(gx_matrix::translation(0, 0, -raw(z)));
+                separate.set_position(gx_matrix::translation(0, 0, -raw(z)));
+                lvl.update(clamp(f32(0.3) + z, f32(INT_MIN, raw_tag), f32(0)));
+
+                gx.begin_frame();
+                host::reset_stats();
+                lvl.draw();
+                unsigned const kicks = lvl.frame.size() > 0 ? 1 : 0;
+                UASSERT(host::dma.transfers == kicks && host::dcache.flush_calls == kicks,
+                    "row %d: %u transfers, %u flushes", int(row), host::dma.transfers, host::dcache.flush_calls);
+
+                separate.begin_frame();
+                size_t matrix_rows = 0;
+                for(display_row const& r : lvl.draw_queue) {
+                    if(r.depth <= 0 || r.data.size() == 0)
+                        continue;
+                    one.begin(geometry::draw::scale);
+                    one.add_row(r.data.data(), r.data.size(), r.translation);
+                    one.end();
+                    separate.execute(one.data(), one.size());
+                    ++matrix_rows;
+                }
+
+                gx_stats const& a = gx.totals();
+                gx_stats const& b = separate.totals();
+                UASSERT_EQUAL(a.stack_errors, 0);
+                UASSERT_EQUAL(a.decode_errors, 0);
+                UASSERT_EQUAL(gx.stack_depth(), 0);
+                UASSERT_EQUAL(a.submitted_polygons, b.submitted_polygons);
+                UASSERT_EQUAL(a.culled_polygons, b.culled_polygons);
+                UASSERT_EQUAL(a.polygons, b.polygons);
+                UASSERT_EQUAL(a.vertices, b.vertices);
+                // one push and one pop instead of one of each per row
+                UASSERT(matrix_rows < 2 || a.commands + 2 * (matrix_rows - 1) == b.commands,
+                    "row %d: %u commands linked, %u separately", int(row), unsigned(a.commands), unsigned(b.commands));
+            }
+            gx.detach();
+        });
+
+        UNIT_TEST(gx_frame_uncached,
+        {
+            // Through the uncached mirror the frame is the same, and once
+            // the buffers have grown to size nothing is flushed.
+            level cached { make_grid(level_data_test2, countof(level_data_test2)) };
+            level uncached { make_grid(level_data_test2, countof(level_data_test2)) };
+            uncached.frame.set_uncached(true);
+            std::vector<uint32_t> a, b;
+            for(int pass = 0; pass < 2; ++pass) {
+                cached.reset();
+                uncached.reset();
+                uint32_t flushes = 0;
+                for(size_t z = 0; z < cached.grid.size(); ++z) {
+                    f32 const position = -f32(geometry::draw::block_size) * int32_t(z);
+                    a.clear();
+                    b.clear();
+
+                    host::set_gx_fifo_sink(collect_words, &a);
+                    cached.update(position);
+                    cached.draw();
+
+                    host::set_gx_fifo_sink(collect_words, &b);
+                    host::reset_stats();
+                    uncached.update(position);
+                    uncached.draw();
+                    flushes += host::dcache.flush_calls;
+
+                    UASSERT(a == b, "Frames differ at row %d", int(z));
+                    // no cache line is shared with anything else
+                    UASSERT(uintptr_t(uncached.frame.data()) % 32 == 0, "Frame not on a cache line");
+                }
+                if(pass > 0)
+                    UASSERT_EQUAL(flushes, 0);
+            }
+            host::set_gx_fifo_sink(0, 0);
+        });
+
+        UNIT_TEST(gx_profile_quad,
+        {
+            uint32_t buf[64];
+            disp_writer writer(buf, buf + countof(buf), { 0, 0, 0 }, { 1, 1, 1 });
+            writer
+                << diffuse_ambient { make_rgb(24, 24, 24), make_rgb(3, 3, 3), true }
+                << normal { { 0, 0, 1 } }
+                << quad { { -0.5, -0.5, 0 }, { 0.5, -0.5, 0 }, { 0.5, 0.5, 0 }, { -0.5, 0.5, 0 } }
+                << end;
+
+            host::gx_profile p;
+            p.add(buf, writer.write_count());
+            UASSERT_EQUAL(p.decode_errors, 0);
+            UASSERT_EQUAL(p.primitives, 1);
+            UASSERT_EQUAL(p.polygons, 1);
+            UASSERT_EQUAL(p.commands[id(gfx_normal)].count, 1);
+            UASSERT_EQUAL(p.commands[id(gfx_normal)].cycles, host::gx_command_cycles(id(gfx_normal)));
+
+            size_t commands = 0, parameters = 0, cycles = 0;
+            for(size_t i = 0; i < 256; ++i) {
+                commands += p.commands[i].count;
+                parameters += p.commands[i].words;
+                cycles += p.commands[i].cycles;
+            }
+            UASSERT_EQUAL(commands, 10);
+            UASSERT_EQUAL(cycles, p.cycles);
+            UASSERT_EQUAL(p.packs + parameters, writer.write_count());
+            UASSERT_EQUAL(4 * p.packs - p.nops, commands);
+        });
+
+        UNIT_TEST(gx_profile_matches_interpreter,
+        {
+            level lvl { make_grid(level_data_test0, countof(level_data_test0)) };
+            gx_interpreter gx;
+            host::gx_profile p;
+            size_t submitted = 0, commands = 0;
+            for(auto row = lvl.grid.begin(); row != lvl.grid.end(); ++row) {
+                display_row r = lvl.generate_row_display_list(row);
+                gx_stats const s = gx.execute(r.data.data(), r.data.size());
+                submitted += s.submitted_polygons;
+                commands += s.commands;
+                p.add(r.data.data(), r.data.size());
+            }
+            UASSERT_EQUAL(p.decode_errors, 0);
+            UASSERT_EQUAL(p.polygons, submitted);
+            UASSERT_EQUAL(4 * p.packs - p.nops, commands);
+        });
+
+        UNIT_TEST(gx_strips_draw_the_same,
+        {
+            // Every row of test0 written with and without strips must give
+            // the same polygons after culling and clipping.
+            grid_t const grid = make_grid(level_data_test0, countof(level_data_test0));
+            gx_interpreter gx;
+            gx.set_projection(game_projection());
+            strip_builder strips;
+            static uint32_t plain[8192], stripped[8192];
+            for(size_t r = 0; r < grid.size(); ++r) {
+                vector3f32 const translation(-3.5 * geometry::draw::block_size, 0, -f32(geometry::draw::block_size) * int32_t(r));
+                disp_writer a(plain, plain + countof(plain), translation, geometry::draw::scale);
+                disp_writer b(stripped, stripped + countof(stripped), translation, geometry::draw::scale);
+                b.set_strip_builder(&strips);
+                vector3f16 offset { 0, 0, 0 };
+                for(size_t i = 0; i < grid[r].size(); ++i, offset.x += geometry::draw::block_size) {
+                    if(grid[r][i].depth > 0) {
+                        draw_cell const dc { grid[r][i].data, offset, { 1, 1, grid[r][i].depth } };
+                        a << dc;
+                        b << dc;
+                    }
+                }
+                a << end;
+                b << end;
+                UASSERT(bool(a) && bool(b), "Writer not OK");
+                UASSERT(b.write_count() <= a.write_count(), "Row %d grew", int(r));
+
+                gx_stats const sa = gx.execute(plain, a.write_count());
+                gx_stats const sb = gx.execute(stripped, b.write_count());
+                UASSERT_EQUAL(sa.submitted_polygons, sb.submitted_polygons);
+                UASSERT_EQUAL(sa.culled_polygons, sb.culled_polygons);
+                UASSERT_EQUAL(sa.polygons, sb.polygons);
+                UASSERT(sb.submitted_vertices <= sa.submitted_vertices, "Row %d has more vertices", int(r));
+            }
+        });
+
+        UNIT_TEST(gx_row_geometry_counts,
+        {
+            level lvl { make_grid(level_data_test2, countof(level_data_test2)) };
+            lvl.coarse_rows = true;
+            gx_interpreter gx;
+            for(auto row = lvl.grid.begin(); row != lvl.grid.end(); ++row) {
+                display_row r = lvl.generate_row_display_list(row);
+                gx_stats const s = gx.execute(r.data.data(), r.data.size());
+                UASSERT_EQUAL(r.geometry.polygons(), s.submitted_polygons);
+                UASSERT_EQUAL(r.geometry.vertices, s.submitted_vertices);
+                gx_stats const c = gx.execute(r.coarse.data(), r.coarse.size());
+                UASSERT_EQUAL(r.coarse_geometry.polygons(), c.submitted_polygons);
+                UASSERT(r.coarse_geometry.polygons() <= r.geometry.polygons(), "Coarse row is not cheaper");
+            }
+        });
+
+        UNIT_TEST(gx_merged_runs,
+        {
+            cell_aux const floor_cell = { 1, cell(1, 1, 0, cell::tile) };
+            grid_t grid(12);
+            for(row_t& row : grid)
+                row.fill(floor_cell);
+            grid[8][3].data.altitude = 1;
+            grid[5][6].depth = 0;
+            merge_runs(grid);
+
+            int const expected[][3] = {
+                // column 0, column 3, column 6
+                { 7, 7, 5 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+                { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 6 }, { 5, 1, 0 },
+                { 0, 1, 0 }, { 0, 3, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+            };
+            for(size_t r = 0; r < grid.size(); ++r) {
+                UASSERT_EQUAL(grid[r][0].depth, expected[r][0]);
+                UASSERT_EQUAL(grid[r][3].depth, expected[r][1]);
+                UASSERT_EQUAL(grid[r][6].depth, expected[r][2]);
+            }
+
+            // A row stays in the window until the runs it starts have gone
+            // past.
+            level lvl { std::move(grid) };
+            f32 const block = geometry::draw::block_size;
+            lvl.update(0);
+            lvl.update(-block * 3);
+            UASSERT(lvl.visible_start == lvl.grid.begin(), "Run dropped early");
+            UASSERT_EQUAL(lvl.draw_queue.front().depth, 7);
+            lvl.update(-block * 7);
+            UASSERT(lvl.visible_start == lvl.grid.begin() + 6, "Rows %d..6 kept", int(lvl.visible_start - lvl.grid.begin()));
+            UASSERT_EQUAL(lvl.draw_queue.front().depth, 6);
+        });
+
+        UNIT_TEST(gx_hidden_faces,
+        {
+            auto const make = [](unsigned flags, uint8_t altitude) {
+                return cell(1, 1, altitude, cell::cellflags_t(flags));
+            };
+            cell const tile = make(cell::tile, 0);
+            cell const low = make(cell::tile | cell::low, 0);
+            cell const high = make(cell::tile | cell::high, 0);
+            cell const round = make(cell::tile | cell::tunnel, 0);
+            cell const open = make(cell::tunnel, 0);
+            cell const high_tunnel = make(cell::tile | cell::tunnel | cell::high, 0);
+
+            // far.face_required(near)
+            UASSERT(!tile.face_required(tile), "Tile front behind a tile");
+            UASSERT(low.face_required(tile), "Block front behind a tile");
+            UASSERT(!low.face_required(high), "Block front behind a taller block");
+            UASSERT(tile.face_required(open), "Tile front behind a tunnel without a floor");
+            UASSERT(!round.face_required(round), "Tunnel front behind the same tunnel");
+            UASSERT(!round.face_required(low), "Tunnel front behind a block as tall");
+            UASSERT(high_tunnel.face_required(low), "High tunnel front behind a low block");
+            UASSERT(tile.face_required(make(cell::tile, 1)), "Front at another altitude");
+
+            // cell.side_required(neighbour)
+            UASSERT(!tile.side_required(tile), "Tile side next to a tile");
+            UASSERT(low.side_required(tile), "Block side next to a tile");
+            UASSERT(!round.side_required(tile), "Tunnel side next to a tile");
+            UASSERT(round.side_required(open), "Tunnel side next to a tunnel without a floor");
+            UASSERT(tile.side_required(make(cell::tile, 1)), "Side at another altitude");
+
+            // Culling only ever takes faces away.
+            level culled { make_grid(level_data_test2, countof(level_data_test2)) };
+            level full { make_grid(level_data_test2, countof(level_data_test2)) };
+            full.cull_hidden = false;
+            size_t culled_total = 0, full_total = 0;
+            for(size_t row = 0; row < culled.grid.size(); ++row) {
+                size_t const c = culled.generate_row_display_list(culled.grid.begin() + row).geometry.polygons();
+                size_t const f = full.generate_row_display_list(full.grid.begin() + row).geometry.polygons();
+                UASSERT(c <= f, "Row %d: %d polygons culled, %d without", int(row), int(c), int(f));
+                culled_total += c;
+                full_total += f;
+            }
+            UASSERT(culled_total < full_total, "Nothing culled");
+        });
+
+        UNIT_TEST(gx_facing_away,
+        {
+            // Off the centre, a block loses one side of the block and one
+            // of its tile, and a round tunnel one side of its tile and the
+            // outermost piece of its shell on that side.
+            cell const cells[] = {
+                cell(1, 1, 0, cell::cellflags_t(cell::tile | cell::low)),
+                cell(1, 1, 0, cell::cellflags_t(cell::tile | cell::tunnel)),
+            };
+            for(cell const c : cells) {
+                grid_t grid(1);
+                grid[0].fill(cell_aux { 1, c });
+                level lvl { std::move(grid) };
+                lvl.cull_hidden = false;
+                size_t const all = lvl.generate_row_display_list(lvl.grid.begin()).geometry.polygons();
+                lvl.cull_facing_away = true;
+                size_t const culled = lvl.generate_row_display_list(lvl.grid.begin()).geometry.polygons();
+                lvl.cull_facing_away = false;
+                size_t const full = lvl.generate_row_display_list(lvl.grid.begin()).geometry.polygons();
+                UASSERT_EQUAL(all, culled);
+                UASSERT_EQUAL(full - culled, size_t(6 * 2));
+            }
+        });
+
+        // The rows of the window, as the index of each in the grid and its
+        // list, after checking that they are in order.
+        std::vector<std::pair<size_t, uint32_t const*>> window_of(level& lvl) {
+            std::vector<std::pair<size_t, uint32_t const*>> rows;
+            UASSERT_EQUAL(lvl.draw_queue.size(), size_t(lvl.visible_end - lvl.visible_start));
+            UASSERT(lvl.draw_queue.size() < level::window_rows, "%d rows in the window", int(lvl.draw_queue.size()));
+            size_t index = lvl.visible_start - lvl.grid.begin();
+            for(display_row const& dl : lvl.draw_queue) {
+                UASSERT(dl.translation.z == -f32(geometry::draw::block_size) * int32_t(index),
+                    "Row %d out of place", int(index));
+                UASSERT_EQUAL(dl.depth, lvl.generate_row_display_list(lvl.grid.begin() + index).depth);
+                rows.push_back(std::make_pair(index++, dl.data.data()));
+            }
+            return rows;
+        }
+
+        UNIT_TEST(gx_window_backwards,
+        {
+            f32 const block = geometry::draw::block_size;
+            level lvl { make_grid(level_data_test0, countof(level_data_test0)) };
+            level fresh { make_grid(level_data_test0, countof(level_data_test0)) };
+
+            // Backing up gives the same window as coming straight there.
+            for(int32_t z = 0; z <= 100; ++z)
+                lvl.update(-block * z);
+            for(int32_t z = 100; z >= 40; --z)
+                lvl.update(-block * z);
+            fresh.update(-block * 40);
+            UASSERT(lvl.visible_start - lvl.grid.begin() == fresh.visible_start - fresh.grid.begin()
+                 && lvl.visible_end - lvl.grid.begin() == fresh.visible_end - fresh.grid.begin(),
+                "Window %d..%d, expected %d..%d",
+                int(lvl.visible_start - lvl.grid.begin()), int(lvl.visible_end - lvl.grid.begin()),
+                int(fresh.visible_start - fresh.grid.begin()), int(fresh.visible_end - fresh.grid.begin()));
+            auto const back = window_of(lvl);
+
+            // Rocking back and forth brings back the evicted rows instead of
+            // generating them again.
+            lvl.update(-block * 42);
+            lvl.update(-block * 40);
+            UASSERT(window_of(lvl) == back, "Rows generated again");
+
+            // So does jumping out of the window and back.
+            lvl.update(-block * 200);
+            lvl.update(0);
+            UASSERT(lvl.visible_start == lvl.grid.begin(), "Window starts at %d", int(lvl.visible_start - lvl.grid.begin()));
+            window_of(lvl);
+        });
+
+        // Draws the level with a budget too small for it and checks that
+        // nothing beyond the budget reaches the geometry engine.
+        void check_budget(frame_budget::overflow_policy policy) {
+            level lvl { make_grid(level_data_test0, countof(level_data_test0)) };
+            lvl.coarse_rows = policy == frame_budget::cheaper_geometry;
+            frame_budget budget(policy, 100);
+            gx_interpreter gx;
+            gx.attach();
+            size_t left_out = 0;
+            for(size_t z = 0; z < lvl.grid.size(); ++z) {
+                gx.begin_frame();
+                budget.begin_frame();
+                lvl.update(-f32(geometry::draw::block_size) * int32_t(z));
+                lvl.draw(budget);
+                UASSERT_EQUAL(gx.totals().submitted_polygons, budget.used.polygons());
+                UASSERT(gx.totals().submitted_polygons <= 100, "Over budget: %d", int(gx.totals().submitted_polygons));
+                if(policy == frame_budget::drop_farthest) {
+                    // what was drawn is the nearest rows, up to the first
+                    // one that didn't fit
+                    size_t rows = 0, polygons = 0;
+                    for(display_row const& dl : lvl.draw_queue)
+                        rows += dl.depth > 0;
+                    size_t drawn = rows - budget.dropped;
+                    for(display_row const& dl : lvl.draw_queue) {
+                        if(dl.depth > 0 && drawn > 0) {
+                            polygons += dl.geometry.polygons();
+                            --drawn;
+                        }
+                    }
+                    UASSERT_EQUAL(polygons, budget.used.polygons());
+                }
+                left_out += budget.dropped + budget.degraded;
+            }
+            gx.detach();
+            UASSERT(left_out > 0, "Budget never ran out");
+        }
+
+        UNIT_TEST(gx_budget_drop_farthest,
+        {
+            check_budget(frame_budget::drop_farthest);
+        });
+
+        UNIT_TEST(gx_budget_cheaper_geometry,
+        {
+            check_budget(frame_budget::cheaper_geometry);
+        });
+
+        // Holds the DMA worker inside the transfer until released.
+        struct held_sink {
+            std::atomic<bool> released;
+            std::vector<uint32_t> words;
+
+            static void write(uint32_t const* w, size_t count, void* user) {
+                held_sink& self = *static_cast<held_sink*>(user);
+                while(!self.released)
+                    std::this_thread::yield();
+                self.words.insert(self.words.end(), w, w + count);
+            }
+        };
+
+        UNIT_TEST(gx_patch_flushes_slot,
+        {
+            display_list lst;
+            lst.resize(128);
+            disp_writer writer(lst, { 0, 0, 0 }, geometry::draw::scale);
+            patch_slot const where = writer.translation_slot();
+            writer << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } } << end;
+            lst.resize(writer.write_count());
+
+            gx_interpreter gx;
+            gx.attach();
+            lst.draw();
+
+            // only the patched words go out of the cache
+            host::reset_stats();
+            lst.patch(where, vector3f32(0, 0, -2));
+            lst.draw();
+            UASSERT_EQUAL(host::dcache.flushed_bytes, 12);
+            lst.draw();
+            UASSERT_EQUAL(host::dcache.flushed_bytes, 12);
+            gx.detach();
+            UASSERT_EQUAL(gx.execute(lst.data(), lst.size()).submitted_polygons, 1);
+        });
+
+        // Bakes the level and checks that every row taken from the baked
+        // file is word for word the row the level generates by itself.
+        void check_baked(unsigned char const* data, size_t size) {
+            level generated { make_grid(data, size) };
+            level loaded { make_grid(data, size) };
+            std::vector<uint32_t> file;
+            bake_rows(generated, data, size, file);
+
+            baked_rows rows;
+            UASSERT(rows.load(&file[0], file.size() * 4, data, size), "Baked rows do not load");
+            UASSERT_EQUAL(rows.size(), generated.grid.size());
+            loaded.use_baked(&rows);
+
+            auto b = loaded.grid.begin();
+            for(auto g = generated.grid.begin(); g != generated.grid.end(); ++g, ++b) {
+                display_row const gr = generated.generate_row_display_list(g);
+                display_row const br = loaded.generate_row_display_list(b);
+                UASSERT_EQUAL(gr.data.size(), br.data.size());
+                UASSERT(gr.data.size() == 0
+                     || std::memcmp(gr.data.data(), br.data.data(), gr.data.size() * 4) == 0,
+                     "Baked row %d differs", int(g - generated.grid.begin()));
+                UASSERT_EQUAL(gr.depth, br.depth);
+                UASSERT_EQUAL(gr.geometry.quads, br.geometry.quads);
+                UASSERT_EQUAL(gr.geometry.triangles, br.geometry.triangles);
+                UASSERT_EQUAL(gr.geometry.strip_vertices, br.geometry.strip_vertices);
+                UASSERT_EQUAL(gr.geometry.vertices, br.geometry.vertices);
+                UASSERT_EQUAL(raw(gr.translation.z), raw(br.translation.z));
+            }
+
+            // Nothing but the lists comes from the file, so whole frames
+            // come out the same too.
+            for(size_t z = 0; z < generated.grid.size(); z += 7) {
+                f32 const position = -f32(geometry::draw::block_size) * int32_t(z);
+                generated.update(position);
+                loaded.update(position);
+                frame_budget ga, la;
+                generated.link(ga);
+                loaded.link(la);
+                UASSERT_EQUAL(generated.frame.size(), loaded.frame.size());
+                UASSERT(generated.frame.size() == 0
+                     || std::memcmp(generated.frame.data(), loaded.frame.data(), generated.frame.size() * 4) == 0,
+                     "Baked frame %d differs", int(z));
+            }
+        }
+
+        UNIT_TEST(gx_baked_rows_match,
+        {
+            check_baked(level_data_test0, countof(level_data_test0));
+            check_baked(level_data_test2, countof(level_data_test2));
+        });
+
+        UNIT_TEST(gx_baked_rows_rejected,
+        {
+            level lvl { make_grid(level_data_test2, countof(level_data_test2)) };
+            std::vector<uint32_t> file;
+            bake_rows(lvl, level_data_test2, countof(level_data_test2), file);
+            size_t const bytes = file.size() * 4;
+
+            baked_rows rows;
+            UASSERT(!rows.load(&file[0], bytes, level_data_test0, countof(level_data_test0)), "Loaded against another level");
+            UASSERT(!rows.load(&file[0], bytes - 4, level_data_test2, countof(level_data_test2)), "Loaded a truncated file");
+            UASSERT(!rows.load(&file[0], 8, level_data_test2, countof(level_data_test2)), "Loaded a header");
+
+            // Rows baked with other culling settings are generated instead.
+            UASSERT(rows.load(&file[0], bytes, level_data_test2, countof(level_data_test2)), "Baked rows do not load");
+            level unculled { make_grid(level_data_test2, countof(level_data_test2)) };
+            unculled.cull_hidden = false;
+            unculled.use_baked(&rows);
+            for(auto row = unculled.grid.begin(); row != unculled.grid.end(); ++row) {
+                display_row const r = unculled.generate_row_display_list(row);
+                UASSERT(r.data.size() == 0 || r.data.data() < &file[0] || r.data.data() >= &file[0] + file.size(),
+                    "Row %d taken from a file baked with culling", int(row - unculled.grid.begin()));
+            }
+
+            // a row reaching past the end of the commands
+            file[baked_rows::header_words + 1] = file[6] + 1;
+            UASSERT(!rows.load(&file[0], bytes, level_data_test2, countof(level_data_test2)), "Loaded a bad row");
+            UASSERT_EQUAL(rows.size(), size_t(0));
+        });
+
+        // Takes hold of DMA3 while the first list goes through, so that
+        // the IRQ handler finds it busy when that list is done.
+        struct hold_dma3_sink {
+            std::vector<uint32_t> words;
+
+            static void write(uint32_t const* w, size_t count, void* user) {
+                hold_dma3_sink& self = *static_cast<hold_dma3_sink*>(user);
+                if(self.words.empty())
+                    host::set_dma_held(3, true);
+                self.words.insert(self.words.end(), w, w + count);
+            }
+        };
+
+        UNIT_TEST(gx_queue_defers_busy_channel,
+        {
+            hold_dma3_sink sink;
+            host::set_gx_fifo_sink(hold_dma3_sink::write, &sink);
+
+            uint32_t const first[] = { 1, 2, 3 };
+            uint32_t const second[] = { 4, 5 };
+            {
+                dma_queue queue;
+                queue.install();
+                // both are queued before the first one's IRQ comes in
+                int const old = host::enter_critical_section();
+                queue.submit(first, countof(first));
+                queue.submit(second, countof(second));
+                host::leave_critical_section(old);
+
+                // the handler left the second list for later instead of
+                // waiting for DMA3
+                UASSERT_EQUAL(sink.words.size(), countof(first));
+                UASSERT(queue.busy(), "Queue idle with a list left");
+                UASSERT(!queue.reached(queue.fence()), "Fence reached with a list left");
+
+                host::set_dma_held(3, false);
+                queue.wait_idle();
+                UASSERT(queue.reached(queue.fence()), "Fence not reached after the queue went idle");
+            }
+            host::set_gx_fifo_sink(0, 0);
+
+            uint32_t const expected[] = { 1, 2, 3, 4, 5 };
+            UASSERT(sink.words == std::vector<uint32_t>(expected, expected + countof(expected)), "Lists out of order");
+        });
+
+        UNIT_TEST(gx_queue_returns_early,
+        {
+            held_sink sink;
+            sink.released = false;
+            host::set_async_dma(true);
+            host::set_gx_fifo_sink(held_sink::write, &sink);
+
+            uint32_t const first[] = { 1, 2, 3 };
+            uint32_t const second[] = { 4, 5 };
+            {
+                dma_queue queue;
+                queue.install();
+                queue.submit(first, countof(first));
+                queue.submit(second, countof(second));
+                dma_queue::fence_t const f = queue.fence();
+
+                // neither list has been sent, yet here we are
+                UASSERT(queue.busy(), "Queue finished before the transfer did");
+                UASSERT(!queue.reached(f), "Fence reached before the transfer finished");
+
+                sink.released = true;
+                queue.wait_idle();
+                UASSERT(queue.reached(f), "Fence not reached after the queue went idle");
+            }
+
+            host::set_async_dma(false);
+            host::set_gx_fifo_sink(0, 0);
+            UASSERT_EQUAL(sink.words.size(), 5);
+            for(size_t i = 0; i < sink.words.size(); ++i)
+                UASSERT_EQUAL(sink.words[i], i + 1);
+        });
+
+        UNIT_TEST(gx_queue_overflow,
+        {
+            // More lists than the queue has room for arrive in order.
+            std::vector<uint32_t> streamed;
+            std::vector<uint32_t> words(dma_queue::capacity * 3);
+            for(size_t i = 0; i < words.size(); ++i)
+                words[i] = i;
+
+            host::set_async_dma(true);
+            host::set_gx_fifo_sink(collect_words, &streamed);
+            {
+                dma_queue queue;
+                queue.install();
+                for(size_t i = 0; i < words.size(); ++i)
+                    queue.submit(&words[i], 1);
+                queue.wait_idle();
+            }
+            host::set_async_dma(false);
+            host::set_gx_fifo_sink(0, 0);
+
+            UASSERT_EQUAL(streamed.size(), words.size());
+            for(size_t i = 0; i < streamed.size(); ++i)
+                UASSERT(streamed[i] == words[i], "[%d] %u != %u", int(i), streamed[i], words[i]);
+        });
+
+        UNIT_TEST(gx_queue_draws_level,
+        {
+            // Submitting through the queue, with each frame's update running
+            // while the last frame is still being sent, draws what a
+            // blocking draw does.
+            std::vector<size_t> expected;
+            {
+                level lvl { make_grid(level_data_test0, countof(level_data_test0)) };
+                frame_budget budget;
+                gx_interpreter gx;
+                gx.attach();
+                for(size_t z = 0; z < lvl.grid.size(); ++z) {
+                    gx.begin_frame();
+                    budget.begin_frame();
+                    lvl.update(-f32(geometry::draw::block_size) * int32_t(z));
+                    lvl.draw(budget);
+                    expected.push_back(gx.totals().submitted_vertices);
+                }
+                gx.detach();
+            }
+
+            level lvl { make_grid(level_data_test0, countof(level_data_test0)) };
+            frame_budget budget;
+            gx_interpreter gx;
+            gx.attach();
+            host::set_async_dma(true);
+            {
+                dma_queue queue;
+                queue.install();
+                for(size_t z = 0; z < lvl.grid.size(); ++z) {
+                    lvl.update(-f32(geometry::draw::block_size) * int32_t(z));
+                    queue.wait_idle();
+                    if(z > 0)
+                        UASSERT_EQUAL(gx.totals().submitted_vertices, expected[z - 1]);
+
+                    gx.begin_frame();
+                    budget.begin_frame();
+                    lvl.submit(budget, queue);
+                }
+                queue.wait_idle();
+                UASSERT_EQUAL(gx.totals().submitted_vertices, expected.back());
+            }
+            host::set_async_dma(false);
+            gx.detach();
+        });
+
+        template <typename T>
+        std::auto_ptr<unit_test_base> make_auto(T* p) { return std::auto_ptr<unit_test_base>(p); }
+    }
+
+    template <>
+    void create_tests<gx_interpreter>(unit_test_suite& suite)
+    {
+        suite.add_test(make_auto(new gx_decode_quad));
+        suite.add_test(make_auto(new gx_cull_and_reject));
+        suite.add_test(make_auto(new gx_quad_strip_shares_vertices));
+        suite.add_test(make_auto(new gx_matrix_stack_errors));
+        suite.add_test(make_auto(new gx_fifo_sink_stream));
+        suite.add_test(make_auto(new gx_chunks_stand_alone));
+        suite.add_test(make_auto(new gx_level_test0_fits));
+        suite.add_test(make_auto(new gx_level_test2_fits));
+        suite.add_test(make_auto(new gx_strips_draw_the_same));
+        suite.add_test(make_auto(new gx_row_geometry_counts));
+        suite.add_test(make_auto(new gx_merged_runs));
+        suite.add_test(make_auto(new gx_hidden_faces));
+        suite.add_test(make_auto(new gx_facing_away));
+        suite.add_test(make_auto(new gx_window_backwards));
+        suite.add_test(make_auto(new gx_budget_drop_farthest));
+        suite.add_test(make_auto(new gx_budget_cheaper_geometry));
+        suite.add_test(make_auto(new gx_frame_linked));
+        suite.add_test(make_auto(new gx_frame_uncached));
+        suite.add_test(make_auto(new gx_patch_flushes_slot));
+        suite.add_test(make_auto(new gx_baked_rows_match));
+        suite.add_test(make_auto(new gx_baked_rows_rejected));
+        suite.add_test(make_auto(new gx_queue_returns_early));
+        suite.add_test(make_auto(new gx_queue_defers_busy_channel));
+        suite.add_test(make_auto(new gx_queue_overflow));
+        suite.add_test(make_auto(new gx_queue_draws_level));
+        suite.add_test(make_auto(new gx_profile_quad));
+        suite.add_test(make_auto(new gx_profile_matches_interpreter));
+    }
+}
+
+#endif
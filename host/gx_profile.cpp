@@ -0,0 +1,275 @@
+#include "gx_profile.h"
+
+#include <algorithm>
+#include <vector>
+#include "command_stream.h"
+#include "frame_budget.h"
+
+namespace roads
+{
+    namespace host
+    {
+        namespace
+        {
+            enum
+            {
+                cmd_normal     = 0x21,
+                cmd_vtx_16     = 0x23,
+                cmd_vtx_diff   = 0x28,
+                cmd_begin_vtxs = 0x40
+            };
+
+            bool is_vertex(uint8_t id)
+            {
+                return id >= cmd_vtx_16 && id <= cmd_vtx_diff;
+            }
+
+            char const* primitive_name(uint32_t primitive)
+            {
+                static char const* const names[] = { "triangles", "quads", "triangle strip", "quad strip" };
+                return names[primitive & 3];
+            }
+
+            double percent(size_t part, size_t whole)
+            {
+                return whole ? 100.0 * part / whole : 0.0;
+            }
+        }
+
+        char const* gx_command_name(uint8_t id)
+        {
+            switch(id) {
+            case 0x00: return "NOP";
+            case 0x10: return "MTX_MODE";
+            case 0x11: return "MTX_PUSH";
+            case 0x12: return "MTX_POP";
+            case 0x13: return "MTX_STORE";
+            case 0x14: return "MTX_RESTORE";
+            case 0x15: return "MTX_IDENTITY";
+            case 0x16: return "MTX_LOAD_4x4";
+            case 0x17: return "MTX_LOAD_4x3";
+            case 0x18: return "MTX_MULT_4x4";
+            case 0x19: return "MTX_MULT_4x3";
+            case 0x1a: return "MTX_MULT_3x3";
+            case 0x1b: return "MTX_SCALE";
+            case 0x1c: return "MTX_TRANS";
+            case 0x20: return "COLOR";
+            case 0x21: return "NORMAL";
+            case 0x22: return "TEXCOORD";
+            case 0x23: return "VTX_16";
+            case 0x24: return "VTX_10";
+            case 0x25: return "VTX_XY";
+            case 0x26: return "VTX_XZ";
+            case 0x27: return "VTX_YZ";
+            case 0x28: return "VTX_DIFF";
+            case 0x29: return "POLYGON_ATTR";
+            case 0x2a: return "TEXIMAGE_PARAM";
+            case 0x2b: return "PLTT_BASE";
+            case 0x30: return "DIF_AMB";
+            case 0x31: return "SPE_EMI";
+            case 0x32: return "LIGHT_VECTOR";
+            case 0x33: return "LIGHT_COLOR";
+            case 0x34: return "SHININESS";
+            case 0x40: return "BEGIN_VTXS";
+            case 0x41: return "END_VTXS";
+            case 0x50: return "SWAP_BUFFERS";
+            case 0x60: return "VIEWPORT";
+            case 0x70: return "BOX_TEST";
+            case 0x71: return "POS_TEST";
+            case 0x72: return "VEC_TEST";
+            default:   return "???";
+            }
+        }
+
+        // From the geometry command table in GBATEK.
+        unsigned gx_command_cycles(uint8_t id, unsigned lights)
+        {
+            switch(id) {
+            case 0x10: return 1;   // MTX_MODE
+            case 0x11: return 17;  // MTX_PUSH
+            case 0x12: return 36;  // MTX_POP
+            case 0x13: return 17;  // MTX_STORE
+            case 0x14: return 36;  // MTX_RESTORE
+            case 0x15: return 19;  // MTX_IDENTITY
+            case 0x16: return 34;  // MTX_LOAD_4x4
+            case 0x17: return 30;  // MTX_LOAD_4x3
+            case 0x18: return 35;  // MTX_MULT_4x4
+            case 0x19: return 31;  // MTX_MULT_4x3
+            case 0x1a: return 28;  // MTX_MULT_3x3
+            case 0x1b: return 22;  // MTX_SCALE
+            case 0x1c: return 22;  // MTX_TRANS
+            case 0x20: return 1;   // COLOR
+            case 0x21: return 8 + std::max(lights, 1u); // NORMAL, 9..12
+            case 0x22: return 1;   // TEXCOORD
+            case 0x23: return 9;   // VTX_16
+            case 0x24: return 8;   // VTX_10
+            case 0x25: return 8;   // VTX_XY
+            case 0x26: return 8;   // VTX_XZ
+            case 0x27: return 8;   // VTX_YZ
+            case 0x28: return 8;   // VTX_DIFF
+            case 0x29: return 1;   // POLYGON_ATTR
+            case 0x2a: return 1;   // TEXIMAGE_PARAM
+            case 0x2b: return 1;   // PLTT_BASE
+            case 0x30: return 4;   // DIF_AMB
+            case 0x31: return 4;   // SPE_EMI
+            case 0x32: return 6;   // LIGHT_VECTOR
+            case 0x33: return 1;   // LIGHT_COLOR
+            case 0x34: return 32;  // SHININESS
+            case 0x40: return 1;   // BEGIN_VTXS
+            case 0x41: return 1;   // END_VTXS
+            case 0x50: return 392; // SWAP_BUFFERS
+            case 0x60: return 1;   // VIEWPORT
+            case 0x70: return 103; // BOX_TEST
+            case 0x71: return 9;   // POS_TEST
+            case 0x72: return 5;   // VEC_TEST
+            default:   return 0;
+            }
+        }
+
+        gx_profile::gx_profile()
+            : commands(), lists(0), words(0), packs(0), nops(0),
+              primitives(0), polygons(0), cycles(0), decode_errors(0)
+        {
+        }
+
+        void gx_profile::add(uint32_t const* list, size_t count, unsigned lights)
+        {
+            ++lists;
+            words += count;
+
+            std::vector<decoded_command> decoded;
+            if(count > 0 && !decode_commands(list, count, decoded))
+                ++decode_errors;
+
+            size_t parameters = 0;
+            geometry_counter counter;
+            for(size_t i = 0; i < decoded.size(); ++i) {
+                decoded_command const& c = decoded[i];
+                unsigned const cost = gx_command_cycles(c.id, lights);
+                entry& e = commands[c.id];
+                ++e.count;
+                e.words += c.pcount;
+                e.cycles += cost;
+                cycles += cost;
+                parameters += c.pcount;
+
+                if(c.id == cmd_begin_vtxs) {
+                    ++primitives;
+                    counter.begin(c.params[0] & 3);
+                }
+                else if(is_vertex(c.id)) {
+                    counter.vertex();
+                }
+            }
+            polygons += counter.counts.polygons();
+
+            // Everything that isn't a parameter is a header; a truncated list
+            // doesn't decode far enough to say.
+            if(parameters <= count) {
+                size_t const headers = count - parameters;
+                packs += headers;
+                nops += 4 * headers - std::min(4 * headers, decoded.size());
+            }
+        }
+
+        gx_profile& gx_profile::operator+=(gx_profile const& rhs)
+        {
+            for(size_t i = 0; i < 256; ++i) {
+                commands[i].count += rhs.commands[i].count;
+                commands[i].words += rhs.commands[i].words;
+                commands[i].cycles += rhs.commands[i].cycles;
+            }
+            lists += rhs.lists;
+            words += rhs.words;
+            packs += rhs.packs;
+            nops += rhs.nops;
+            primitives += rhs.primitives;
+            polygons += rhs.polygons;
+            cycles += rhs.cycles;
+            decode_errors += rhs.decode_errors;
+            return *this;
+        }
+
+        void print_profile(std::FILE* out, gx_profile const& p)
+        {
+            std::vector<uint8_t> ids;
+            for(size_t i = 0; i < 256; ++i) {
+                if(p.commands[i].count > 0)
+                    ids.push_back(uint8_t(i));
+            }
+            std::stable_sort(ids.begin(), ids.end(), [&](uint8_t a, uint8_t b) {
+                return p.commands[a].cycles > p.commands[b].cycles;
+            });
+
+            std::fprintf(out, "  %-14s %8s %8s %10s %7s\n", "command", "count", "words", "cycles", "share");
+            for(size_t i = 0; i < ids.size(); ++i) {
+                gx_profile::entry const& e = p.commands[ids[i]];
+                std::fprintf(out, "  %-14s %8u %8u %10u %6.1f%%\n",
+                    gx_command_name(ids[i]), unsigned(e.count), unsigned(e.words),
+                    unsigned(e.cycles), percent(e.cycles, p.cycles));
+            }
+            std::fprintf(out, "  %-14s %8u %8u\n", "headers", unsigned(p.packs), unsigned(p.packs));
+            std::fprintf(out, "  lists %u, words %u, cycles %u (%.1f%% of a frame)\n",
+                unsigned(p.lists), unsigned(p.words), unsigned(p.cycles), percent(p.cycles, gx_frame_cycles));
+            std::fprintf(out, "  primitives %u, polygons %u, %.1f words/primitive, %.2f words/polygon, %.1f cycles/polygon\n",
+                unsigned(p.primitives), unsigned(p.polygons),
+                p.primitives ? double(p.words) / p.primitives : 0.0,
+                p.polygons ? double(p.words) / p.polygons : 0.0,
+                p.polygons ? double(p.cycles) / p.polygons : 0.0);
+            std::fprintf(out, "  empty header slots %u (%.1f%%)",
+                unsigned(p.nops), percent(p.nops, 4 * p.packs));
+            if(p.decode_errors)
+                std::fprintf(out, ", %u list(s) failed to decode", unsigned(p.decode_errors));
+            std::fprintf(out, "\n");
+        }
+
+        void disassemble(std::FILE* out, uint32_t const* words, size_t count)
+        {
+            size_t i = 0;
+            while(i < count) {
+                size_t const header = i;
+                uint32_t const pack = words[i++];
+                if(pack == 0) {
+                    std::fprintf(out, "%04x  %-14s\n", unsigned(header), "(empty)");
+                    continue;
+                }
+
+                for(unsigned slot = 0; slot < 4; ++slot) {
+                    uint8_t const id = (pack >> (slot * 8)) & 0xFF;
+                    if(id == 0)
+                        continue;
+
+                    int const params = gx_param_count(id);
+                    if(params < 0 || i + params > count) {
+                        std::fprintf(out, "%04x  %s %02x, stopping\n", unsigned(header),
+                            params < 0 ? "unknown command" : "truncated command", id);
+                        return;
+                    }
+
+                    std::fprintf(out, "%04x  %-14s %3u ", unsigned(header), gx_command_name(id), gx_command_cycles(id));
+                    // long parameter lists (matrices, SHININESS) are elided
+                    for(int p = 0; p < std::min(params, 4); ++p)
+                        std::fprintf(out, " %08x", words[i + p]);
+                    if(params > 4)
+                        std::fprintf(out, " ...");
+
+                    if(id == cmd_begin_vtxs) {
+                        std::fprintf(out, "  ; %s", primitive_name(words[i]));
+                    }
+                    else if(id == cmd_vtx_16) {
+                        std::fprintf(out, "  ; %d, %d, %d",
+                            int16_t(words[i]), int16_t(words[i] >> 16), int16_t(words[i + 1]));
+                    }
+                    else if(id == cmd_normal) {
+                        // 1.9 fixed point, 10 bits per component
+                        std::fprintf(out, "  ; %d, %d, %d",
+                            int32_t(words[i] << 22) >> 22, int32_t(words[i] << 12) >> 22, int32_t(words[i] << 2) >> 22);
+                    }
+                    std::fprintf(out, "\n");
+
+                    i += params;
+                }
+            }
+        }
+    }
+}
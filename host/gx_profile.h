@@ -0,0 +1,68 @@
+#ifndef ROADS_HOST_GX_PROFILE_H
+#define ROADS_HOST_GX_PROFILE_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace roads
+{
+    namespace host
+    {
+        // Geometry engine clock cycles in one 60 Hz frame (263 lines of 355
+        // dots, 6 cycles per dot at 33.51 MHz).
+        enum { gx_frame_cycles = 560190 };
+
+        // The command's mnemonic as GBATEK spells it, e.g. "MTX_PUSH", or
+        // "???" for ids the hardware doesn't know.
+        char const* gx_command_name(uint8_t id);
+
+        // Documented execution time of the command in geometry engine
+        // cycles, not counting the time spent waiting in the FIFO. NORMAL
+        // depends on the number of enabled lights; the game uses one.
+        unsigned gx_command_cycles(uint8_t id, unsigned lights = 1);
+
+        // Static cost breakdown of one or more packed display lists:
+        // nothing is executed, the commands are only counted and priced.
+        struct gx_profile
+        {
+            struct entry
+            {
+                size_t count;  // times the command appears
+                size_t words;  // its parameter words
+                size_t cycles; // estimated execution time
+            };
+
+            entry commands[256];
+            size_t lists;
+            size_t words;      // total, headers included
+            size_t packs;      // header words
+            size_t nops;       // empty slots in the headers
+            size_t primitives; // BEGIN_VTXS
+            size_t polygons;   // polygons those primitives make up
+            size_t cycles;
+            size_t decode_errors;
+
+            gx_profile();
+
+            void add(uint32_t const* words, size_t count, unsigned lights = 1);
+
+            template <typename List>
+            void add(List const& list)
+            {
+                add(list.empty() ? 0 : &*list.begin(), list.size());
+            }
+
+            gx_profile& operator+=(gx_profile const& rhs);
+        };
+
+        // Prints the histogram, sorted by estimated cost, and the totals.
+        void print_profile(std::FILE* out, gx_profile const& profile);
+
+        // Prints one command per line with its parameters and cost, with the
+        // offset of the command's header word in front.
+        void disassemble(std::FILE* out, uint32_t const* words, size_t count);
+    }
+}
+
+#endif // ROADS_HOST_GX_PROFILE_H
@@ -0,0 +1,89 @@
+#ifndef ROADS_HOST_NDS_H
+#define ROADS_HOST_NDS_H
+
+// The subset of libnds that the unit tests use to spell out expected
+// display lists. Definitions follow libnds so the tests compare against the
+// same values on both platforms.
+
+#include <stdint.h>
+#include "nds/arm9/math.h"
+#include "roads_host.h"
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+
+typedef int16_t v16;
+typedef int16_t v10;
+typedef int16_t t16;
+
+#define RGB15(r,g,b)  ((r)|((g)<<5)|((b)<<10))
+
+#define inttov16(n)   ((v16)((n) << 12))
+#define floattov16(n) ((v16)((n) * (1 << 12)))
+#define floattov10(n) ((n > .998) ? 0x1FF : ((v10)((n)*(1<<9))))
+#define inttot16(n)   ((n) << 4)
+
+#define VERTEX_PACK(n,m)   ((uint32_t)(((n) & 0xFFFF) | ((m) << 16)))
+#define NORMAL_PACK(x,y,z) ((uint32_t)(((x) & 0x3FF) | (((y) & 0x3FF) << 10) | ((z) << 20)))
+#define TEXTURE_PACK(u,v)  ((uint32_t)(((u) & 0xFFFF) | ((v) << 16)))
+
+#define REG2ID(r) (u8)((((u32)(uintptr_t)(&(r)))-0x04000400)>>2)
+
+#define FIFO_COMMAND_PACK(c1,c2,c3,c4) (((c4) << 24) | ((c3) << 16) | ((c2) << 8) | (c1))
+
+// Register addresses are only ever used through REG2ID, so they are given
+// as lvalues at their real addresses without ever being dereferenced.
+#define ROADS_HOST_GFX_REG(addr) (*(u32*)(uintptr_t)(addr))
+
+#define MATRIX_CONTROL   ROADS_HOST_GFX_REG(0x04000440)
+#define MATRIX_PUSH      ROADS_HOST_GFX_REG(0x04000444)
+#define MATRIX_POP       ROADS_HOST_GFX_REG(0x04000448)
+#define MATRIX_STORE     ROADS_HOST_GFX_REG(0x0400044C)
+#define MATRIX_RESTORE   ROADS_HOST_GFX_REG(0x04000450)
+#define MATRIX_IDENTITY  ROADS_HOST_GFX_REG(0x04000454)
+#define MATRIX_LOAD4x4   ROADS_HOST_GFX_REG(0x04000458)
+#define MATRIX_LOAD4x3   ROADS_HOST_GFX_REG(0x0400045C)
+#define MATRIX_MULT4x4   ROADS_HOST_GFX_REG(0x04000460)
+#define MATRIX_MULT4x3   ROADS_HOST_GFX_REG(0x04000464)
+#define MATRIX_MULT3x3   ROADS_HOST_GFX_REG(0x04000468)
+#define MATRIX_SCALE     ROADS_HOST_GFX_REG(0x0400046C)
+#define MATRIX_TRANSLATE ROADS_HOST_GFX_REG(0x04000470)
+
+#define FIFO_NOP               0x00
+#define FIFO_STATUS            0x00
+#define FIFO_COLOR             0x20
+#define FIFO_NORMAL            0x21
+#define FIFO_TEX_COORD         0x22
+#define FIFO_VERTEX16          0x23
+#define FIFO_VERTEX10          0x24
+#define FIFO_VERTEX_XY         0x25
+#define FIFO_VERTEX_XZ         0x26
+#define FIFO_VERTEX_YZ         0x27
+#define FIFO_VERTEX_DIFF       0x28
+#define FIFO_POLY_FORMAT       0x29
+#define FIFO_TEX_FORMAT        0x2A
+#define FIFO_PAL_FORMAT        0x2B
+#define FIFO_DIFFUSE_AMBIENT   0x30
+#define FIFO_SPECULAR_EMISSION 0x31
+#define FIFO_LIGHT_VECTOR      0x32
+#define FIFO_LIGHT_COLOR       0x33
+#define FIFO_SHININESS         0x34
+#define FIFO_BEGIN             0x40
+#define FIFO_END               0x41
+#define FIFO_FLUSH             0x50
+#define FIFO_VIEWPORT          0x60
+
+enum GL_GLBEGIN_ENUM {
+    GL_TRIANGLES      = 0,
+    GL_QUADS          = 1,
+    GL_TRIANGLE_STRIP = 2,
+    GL_QUAD_STRIP     = 3,
+    GL_TRIANGLE       = 0,
+    GL_QUAD           = 1
+};
+
+#endif // ROADS_HOST_NDS_H
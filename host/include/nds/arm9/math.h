@@ -0,0 +1,48 @@
+#ifndef ROADS_HOST_NDS_ARM9_MATH_H
+#define ROADS_HOST_NDS_ARM9_MATH_H
+
+// Host stand-in for libnds' hardware divider helpers. The ARM9 versions
+// program the divider registers at 0x04000280; here we divide in software
+// but reproduce what the divider does for the inputs that would trap on
+// x86: division by zero yields +/-1 with the opposite sign of the numerator
+// and leaves the numerator as the remainder, and INT_MIN / -1 wraps.
+
+#include <stdint.h>
+
+static inline int32_t div32(int32_t num, int32_t den)
+{
+    if(den == 0)
+        return num < 0 ? 1 : -1;
+    if(den == -1)
+        return int32_t(0u - uint32_t(num));
+    return num / den;
+}
+
+static inline int32_t mod32(int32_t num, int32_t den)
+{
+    if(den == 0)
+        return num;
+    if(den == -1)
+        return 0;
+    return num % den;
+}
+
+static inline int32_t div64(int64_t num, int32_t den)
+{
+    if(den == 0)
+        return num < 0 ? 1 : -1;
+    if(den == -1)
+        return int32_t(0u - uint32_t(num));
+    return int32_t(num / den);
+}
+
+static inline int32_t mod64(int64_t num, int32_t den)
+{
+    if(den == 0)
+        return int32_t(num);
+    if(den == -1)
+        return 0;
+    return int32_t(num % den);
+}
+
+#endif // ROADS_HOST_NDS_ARM9_MATH_H
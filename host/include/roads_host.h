@@ -0,0 +1,96 @@
+#ifndef ROADS_HOST_H
+#define ROADS_HOST_H
+
+// Stand-ins for the bits of libnds and the ARM9 hardware that the engine
+// core touches. The host build force-includes this header into every
+// translation unit (see host/Makefile) so that the sources can stay exactly
+// as they are compiled for the DS.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <climits>
+
+extern "C" int iprintf(char const* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+namespace roads
+{
+    namespace host
+    {
+        enum { io_base = 0x04000000, io_size = 0x1000 };
+
+        // Backing store for gfx_reg and friends. Writes simply land here;
+        // nothing in the host build reacts to them.
+        extern uint8_t io_registers[io_size];
+
+        // iprintf output is dropped unless this is set, since the engine
+        // prints debugging information from its hot paths.
+        extern bool console_enabled;
+
+        // DC_FlushRange does nothing on the host except count what it was
+        // asked to flush.
+        struct cache_stats
+        {
+            uint32_t flush_calls;
+            uint64_t flushed_bytes;
+        };
+        extern cache_stats dcache;
+
+        struct dma_stats
+        {
+            uint32_t transfers;
+            uint64_t words;
+        };
+        extern dma_stats dma;
+
+        // Receives every block of words that is DMAed into the geometry
+        // engine's command FIFO. The default sink discards them.
+        typedef void (*fifo_sink_t)(uint32_t const* words, size_t count, void* user);
+        void set_gx_fifo_sink(fifo_sink_t sink, void* user);
+
+        // Stand-in for a CPU store to the GX FIFO port; the word goes to the
+        // same sink as DMA transfers do.
+        void write_gx_fifo(uint32_t word);
+
+        void reset_stats();
+
+        // Stand-ins for irqSet on the DMA IRQs and for enterCriticalSection
+        // and leaveCriticalSection. A handler never runs while some thread
+        // is inside a critical section; an IRQ raised on the thread that is
+        // inside one, or inside a handler, is held until it leaves.
+        typedef void (*irq_handler_t)();
+        void set_dma_irq_handler(unsigned channel, irq_handler_t handler);
+        int enter_critical_section();
+        void leave_critical_section(int old);
+
+        // With async DMA, transfers are run by a worker thread: a control
+        // register reads as busy until the worker has pushed the words into
+        // the FIFO sink, and then the channel's IRQ is raised from the
+        // worker if the control word asked for one. Turning it off waits for
+        // the worker to finish. The sink is called from the worker, so
+        // whatever it touches mustn't be looked at before the transfer is
+        // done.
+        void set_async_dma(bool async);
+
+        // Makes a channel's control register read as busy, as if something
+        // else were using the channel, until it is let go again.
+        void set_dma_held(unsigned channel, bool held);
+
+        // Proxy returned by dma_reg on the host. Reads behave like the
+        // hardware register; writing a control register with the enable bit
+        // set performs the whole transfer immediately (or hands it to the
+        // worker, see set_async_dma), so without async DMA the busy bit is
+        // already clear by the time anyone polls it.
+        struct dma_register
+        {
+            explicit dma_register(unsigned offset) : offset(offset) {}
+
+            operator uint32_t() const;
+            dma_register const& operator=(uintptr_t value) const;
+
+        private:
+            unsigned offset;
+        };
+    }
+}
+
+#endif // ROADS_HOST_H
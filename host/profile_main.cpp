@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "gx_profile.h"
+#include "level.h"
+#include "disp_writer.h"
+#include "ship_shape.h"
+#include "geometry.h"
+#include "utility.h"
+
+extern const unsigned char level_data_test0[15182];
+extern const unsigned char level_data_test2[6278];
+
+// Static cost report for the display lists the game draws: the ship and
+// every row of the test levels. Pass -d to also disassemble the ship list
+// and the most expensive row of each level.
+namespace roads
+{
+    namespace
+    {
+        bool disassembly = false;
+
+        void profile_ship() {
+            using geometry::draw::ship_size;
+            vector3f32 move;
+            move.x = ship_size.x * f32(-0.5);
+            move.y = geometry::draw::tile_height * 5;
+            move.z = ship_size.z * f32(0.5) - f32(geometry::draw::block_size) * f32(0.5);
+
+            display_list ship;
+            ship.resize(128);
+            disp_writer writer(ship, move, geometry::draw::scale);
+            writer << ship_shape::mesh() << end;
+            ship.resize(writer.write_count());
+
+            host::gx_profile profile;
+            profile.add(ship.data(), ship.size());
+
+            std::printf("-- ship\n");
+            if(disassembly)
+                host::disassemble(stdout, ship.data(), ship.size());
+            host::print_profile(stdout, profile);
+        }
+
+        void profile_level(char const* name, unsigned char const* data, size_t size) {
+            level lvl { make_grid(data, size) };
+            size_t const rows = lvl.grid.size();
+
+            std::vector<display_row> lists;
+            std::vector<host::gx_profile> row_profiles(rows);
+            host::gx_profile total;
+            for(size_t i = 0; i < rows; ++i) {
+                lists.push_back(lvl.generate_row_display_list(lvl.grid.begin() + i));
+                slab_list& l = lists.back().data;
+                row_profiles[i].add(l.data(), l.size());
+                total += row_profiles[i];
+            }
+
+            std::printf("-- %s (%u rows)\n", name, unsigned(rows));
+            host::print_profile(stdout, total);
+
+            // the rows that are on screen together, ignoring the ones kept
+            // around for their depth
+            size_t const window = std::min<size_t>(level::draw_distance, rows);
+            size_t worst_start = 0, worst_cycles = 0, cycles = 0;
+            for(size_t i = 0; i < rows; ++i) {
+                cycles += row_profiles[i].cycles;
+                if(i >= window)
+                    cycles -= row_profiles[i - window].cycles;
+                if(i + 1 >= window && cycles > worst_cycles) {
+                    worst_cycles = cycles;
+                    worst_start = i + 1 - window;
+                }
+            }
+            std::printf("  worst window: rows %u-%u, %u cycles (%.1f%% of a frame)\n",
+                unsigned(worst_start), unsigned(worst_start + window - 1),
+                unsigned(worst_cycles), 100.0 * worst_cycles / host::gx_frame_cycles);
+
+            std::vector<size_t> order(rows);
+            for(size_t i = 0; i < rows; ++i)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return row_profiles[a].cycles > row_profiles[b].cycles;
+            });
+            std::printf("  most expensive rows:");
+            for(size_t i = 0; i < std::min<size_t>(5, rows); ++i)
+                std::printf(" %u (%u)", unsigned(order[i]), unsigned(row_profiles[order[i]].cycles));
+            std::printf("\n");
+
+            if(disassembly && rows > 0) {
+                slab_list& l = lists[order[0]].data;
+                std::printf("-- %s row %u\n", name, unsigned(order[0]));
+                host::disassemble(stdout, l.data(), l.size());
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    using namespace roads;
+
+    for(int i = 1; i < argc; ++i) {
+        if(std::strcmp(argv[i], "-d") == 0) {
+            disassembly = true;
+        }
+        else {
+            std::fprintf(stderr, "usage: %s [-d]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    profile_ship();
+    profile_level("test0", level_data_test0, countof(level_data_test0));
+    profile_level("test2", level_data_test2, countof(level_data_test2));
+
+    return 0;
+}
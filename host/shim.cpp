@@ -0,0 +1,284 @@
+#include "roads_host.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Host implementations of the libnds functions and hardware registers that
+// the engine core depends on. See include/roads_host.h.
+
+namespace roads
+{
+    namespace host
+    {
+        uint8_t io_registers[io_size];
+        bool console_enabled = false;
+        cache_stats dcache;
+        dma_stats dma;
+
+        namespace
+        {
+            enum
+            {
+                dma_first_register = 0xB0,
+                dma_register_count = 12,
+                dma_gx_fifo        = io_base + 0x400,
+                dma_count_mask     = 0x1FFFFF,
+                dma_enable_bit     = 1u << 31,
+                dma_irq_bit        = 1u << 30,
+                dma_32_bit_bit     = 1u << 26,
+                dma_dst_fix_bit    = 1u << 22
+            };
+
+            // DMA addresses are kept at full pointer width so that the
+            // source and destination registers can hold host addresses.
+            uintptr_t dma_registers[dma_register_count];
+            // channels set_dma_held makes read as busy
+            std::atomic<unsigned> held_channels(0);
+
+            void discard(uint32_t const*, size_t, void*) {}
+
+            fifo_sink_t gx_fifo_sink = discard;
+            void* gx_fifo_user = 0;
+
+            struct transfer
+            {
+                unsigned channel;
+                uint32_t control;
+                uintptr_t src, dest;
+            };
+
+            void run_transfer(transfer const& t)
+            {
+                size_t const count = t.control & dma_count_mask;
+
+                ++dma.transfers;
+                dma.words += count;
+
+                if(t.dest == dma_gx_fifo) {
+                    gx_fifo_sink(reinterpret_cast<uint32_t const*>(t.src), count, gx_fifo_user);
+                }
+                else if(!(t.control & dma_dst_fix_bit)) {
+                    size_t const unit = (t.control & dma_32_bit_bit) ? 4 : 2;
+                    std::memmove(reinterpret_cast<void*>(t.dest), reinterpret_cast<void const*>(t.src), count * unit);
+                }
+            }
+
+            // Plays the part of REG_IME: held by whoever is inside a
+            // critical section or running a handler.
+            std::recursive_mutex irq_mutex;
+            thread_local int critical_depth = 0;
+            irq_handler_t irq_handlers[4];
+            unsigned pending_irqs = 0;
+
+            // Called with irq_mutex held and outside any critical section.
+            void run_pending_irqs()
+            {
+                while(pending_irqs) {
+                    unsigned const channel = __builtin_ctz(pending_irqs);
+                    pending_irqs &= ~(1u << channel);
+                    if(irq_handlers[channel]) {
+                        ++critical_depth;
+                        irq_handlers[channel]();
+                        --critical_depth;
+                    }
+                }
+            }
+
+            void raise_irq(unsigned channel)
+            {
+                std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+                pending_irqs |= 1u << channel;
+                if(critical_depth == 0)
+                    run_pending_irqs();
+            }
+
+            struct dma_worker
+            {
+                std::mutex mutex;
+                std::condition_variable wake, idle;
+                std::deque<transfer> queue;
+                std::thread thread;
+                std::atomic<unsigned> busy;
+                bool running, stop;
+
+                dma_worker() : busy(0), running(false), stop(false) {}
+                ~dma_worker() { set_running(false); }
+
+                void set_running(bool on)
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if(on == running)
+                        return;
+                    if(on) {
+                        stop = false;
+                        running = true;
+                        thread = std::thread([this] { work(); });
+                        return;
+                    }
+                    idle.wait(lock, [this] { return queue.empty() && busy == 0; });
+                    stop = true;
+                    wake.notify_all();
+                    lock.unlock();
+                    thread.join();
+                    running = false;
+                }
+
+                void push(transfer const& t)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy |= 1u << t.channel;
+                    queue.push_back(t);
+                    wake.notify_all();
+                }
+
+                void work()
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    for(;;) {
+                        wake.wait(lock, [this] { return stop || !queue.empty(); });
+                        if(queue.empty())
+                            return;
+                        transfer const t = queue.front();
+                        queue.pop_front();
+
+                        lock.unlock();
+                        run_transfer(t);
+                        busy &= ~(1u << t.channel);
+                        if(t.control & dma_irq_bit)
+                            raise_irq(t.channel);
+                        lock.lock();
+
+                        idle.notify_all();
+                    }
+                }
+            };
+
+            dma_worker worker;
+            bool async_dma = false;
+        }
+
+        void set_gx_fifo_sink(fifo_sink_t sink, void* user)
+        {
+            gx_fifo_sink = sink ? sink : discard;
+            gx_fifo_user = user;
+        }
+
+        void write_gx_fifo(uint32_t word)
+        {
+            gx_fifo_sink(&word, 1, gx_fifo_user);
+        }
+
+        void reset_stats()
+        {
+            dcache = cache_stats();
+            dma = dma_stats();
+        }
+
+        void set_dma_irq_handler(unsigned channel, irq_handler_t handler)
+        {
+            std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+            irq_handlers[channel] = handler;
+        }
+
+        int enter_critical_section()
+        {
+            irq_mutex.lock();
+            return critical_depth++;
+        }
+
+        void leave_critical_section(int)
+        {
+            if(--critical_depth == 0)
+                run_pending_irqs();
+            irq_mutex.unlock();
+        }
+
+        void set_async_dma(bool async)
+        {
+            worker.set_running(async);
+            async_dma = async;
+        }
+
+        void set_dma_held(unsigned channel, bool held)
+        {
+            if(held)
+                held_channels |= 1u << channel;
+            else
+                held_channels &= ~(1u << channel);
+        }
+
+        dma_register::operator uint32_t() const
+        {
+            unsigned const index = (offset - dma_first_register) / 4;
+            uint32_t value = uint32_t(dma_registers[index]);
+            if(index % 3 == 2 && ((worker.busy | held_channels) & (1u << (index / 3))))
+                value |= dma_enable_bit;
+            return value;
+        }
+
+        dma_register const& dma_register::operator=(uintptr_t value) const
+        {
+            unsigned const index = (offset - dma_first_register) / 4;
+            dma_registers[index] = value;
+
+            // Every third register is a control register.
+            if(index % 3 == 2 && (value & dma_enable_bit)) {
+                unsigned const channel = index / 3;
+                transfer const t = {
+                    channel, uint32_t(value),
+                    dma_registers[channel * 3], dma_registers[channel * 3 + 1]
+                };
+                dma_registers[index] = value & ~uintptr_t(dma_enable_bit);
+
+                if(async_dma) {
+                    worker.push(t);
+                }
+                else {
+                    run_transfer(t);
+                    if(t.control & dma_irq_bit)
+                        raise_irq(channel);
+                }
+            }
+            return *this;
+        }
+    }
+}
+
+extern "C"
+{
+    int iprintf(char const* fmt, ...)
+    {
+        if(!roads::host::console_enabled)
+            return 0;
+
+        va_list args;
+        va_start(args, fmt);
+        int const ret = std::vprintf(fmt, args);
+        va_end(args);
+        return ret;
+    }
+
+    void IC_InvalidateAll() {}
+    void IC_InvalidateRange(void const*, uint32_t) {}
+    void DC_FlushAll() {}
+    void DC_InvalidateAll() {}
+    void DC_InvalidateRange(void const*, uint32_t) {}
+
+    void DC_FlushRange(void const*, uint32_t size)
+    {
+        ++roads::host::dcache.flush_calls;
+        roads::host::dcache.flushed_bytes += size;
+    }
+
+    // There is no cache to go around, so the mirror is the memory itself.
+    void* memUncached(void* address)
+    {
+        return address;
+    }
+}
@@ -0,0 +1,26 @@
+#include "unit_config.h"
+#include "unit_test.h"
+#include "fixed16.h"
+#include "vector.h"
+#include "disp_writer.h"
+#include "collide.h"
+#include "gx_interpreter.h"
+
+// Host counterpart of the RUN_UNIT_TESTS branch of source/main.cpp. Exits
+// with a non-zero status if any test fails.
+int main() {
+    using namespace roads;
+    host::console_enabled = true;
+
+    unit_test_suite suite;
+    create_tests<f16>(suite);
+    create_tests<vector3f16>(suite);
+    create_tests<disp_writer>(suite);
+    create_tests<collide_result_t>(suite);
+    create_tests<host::gx_interpreter>(suite);
+
+    size_t const failures = suite.run_tests();
+    iprintf("%u test(s) failed\n", unsigned(failures));
+
+    return failures == 0 ? 0 : 1;
+}
@@ -1,10 +1,28 @@
 #ifndef DSR_ADDRESS_TRANSFORM_H
 #define DSR_ADDRESS_TRANSFORM_H
 
+#include <stdint.h>
+#include <cstddef>
+
+#ifndef ARM9
+#include "roads_host.h"
+#endif
+
 namespace roads
 {
     namespace detail
     {
+        // Turns an absolute I/O address into a pointer. On the host the I/O
+        // region is an ordinary array supplied by the host shims.
+        template <typename Ptr> Ptr io_pointer(uint32_t addr)
+        {
+#ifdef ARM9
+            return reinterpret_cast<Ptr>(addr);
+#else
+            return reinterpret_cast<Ptr>(host::io_registers + (addr - host::io_base));
+#endif
+        }
+
         // Base class template that provides typedefs and
         // a static function needed in register access
         template <typename ResultType> struct apply_op
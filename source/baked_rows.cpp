@@ -0,0 +1,97 @@
+#include "baked_rows.h"
+#include "level.h"
+
+namespace roads
+{
+    uint32_t level_hash(unsigned char const* level_data, size_t level_size)
+    {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        for(size_t i = 0; i < level_size; ++i) {
+            h ^= level_data[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    bool baked_rows::load(void const* data, size_t size,
+                          unsigned char const* level_data, size_t level_size)
+    {
+        words = 0;
+        rows = 0;
+        commands = 0;
+
+        uint32_t const* const w = static_cast<uint32_t const*>(data);
+        size_t const count = size / 4;
+        if(size % 4 != 0 || count < header_words)
+            return false;
+        if(w[0] != magic || w[1] != version
+        || w[2] != level_size || w[3] != level_hash(level_data, level_size))
+            return false;
+
+        size_t const row_count = w[5];
+        size_t const command_count = w[6];
+        if(count != header_words + row_count * row_words + command_count)
+            return false;
+
+        uint32_t const* const table = w + header_words;
+        for(size_t i = 0; i < row_count; ++i) {
+            uint32_t const* const r = table + i * row_words;
+            if(r[0] > command_count || r[1] > command_count - r[0])
+                return false;
+        }
+
+        words = w;
+        rows = row_count;
+        commands = table + row_count * row_words;
+        return true;
+    }
+
+    baked_rows::row baked_rows::operator[](size_t i) const
+    {
+        uint32_t const* const r = words + header_words + i * row_words;
+        row ret;
+        ret.words = commands + r[0];
+        ret.count = r[1];
+        ret.depth = int(r[2]);
+        ret.geometry.quads = r[3] & 0xffff;
+        ret.geometry.triangles = r[3] >> 16;
+        ret.geometry.strip_vertices = r[4] & 0xffff;
+        ret.geometry.vertices = r[4] >> 16;
+        return ret;
+    }
+
+    void bake_rows(level& lvl, unsigned char const* level_data, size_t level_size,
+                   std::vector<uint32_t>& out)
+    {
+        size_t const row_count = lvl.grid.size();
+        size_t const start = out.size();
+        out.resize(start + baked_rows::header_words + row_count * baked_rows::row_words);
+
+        std::vector<uint32_t> commands;
+        size_t i = 0;
+        for(grid_t::iterator row = lvl.grid.begin(); row != lvl.grid.end(); ++row, ++i) {
+            slab_list lst;
+            int depth;
+            geometry_counts const g = lvl.write_row_list(row, false, lst, depth);
+
+            uint32_t* const r = &out[start + baked_rows::header_words + i * baked_rows::row_words];
+            r[0] = commands.size();
+            r[1] = lst.size();
+            r[2] = depth;
+            r[3] = g.quads | g.triangles << 16;
+            r[4] = g.strip_vertices | g.vertices << 16;
+            commands.insert(commands.end(), lst.data(), lst.data() + lst.size());
+        }
+
+        uint32_t* const h = &out[start];
+        h[0] = baked_rows::magic;
+        h[1] = baked_rows::version;
+        h[2] = level_size;
+        h[3] = level_hash(level_data, level_size);
+        h[4] = lvl.row_flags();
+        h[5] = row_count;
+        h[6] = commands.size();
+        out.insert(out.end(), commands.begin(), commands.end());
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef ROADS_BAKED_ROWS_H
+#define ROADS_BAKED_ROWS_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+#include "frame_budget.h"
+
+namespace roads {
+    struct level;
+
+    /*
+     * The display lists of every row of a level, generated ahead of time
+     * (see host/bake_main.cpp) so that the DS only has to send them.
+     *
+     * A baked file is a sequence of little-endian 32-bit words:
+     *
+     *     magic, version
+     *     size and FNV-1a hash of the level file it was baked from
+     *     the culling the rows were generated with (see level::row_flags)
+     *     row count, command word count
+     *     for each row:
+     *         first command word, command word count, depth,
+     *         quads | triangles << 16, strip vertices | vertices << 16
+     *     the command words of all rows
+     *
+     * The command words are exactly what level::write_row_list produces
+     * for the row, matrix commands left out. Only the full lists are
+     * baked; coarse lists are still generated when level::coarse_rows asks
+     * for them. A level whose culling settings differ from the file's
+     * generates its rows instead.
+     *
+     * The cart build bakes the file again from the current sources every
+     * time (see the Makefile), so the rows can't fall behind the code that
+     * generates them.
+     */
+    struct baked_rows {
+        enum {
+            magic = 0x4b424452, // "RDBK"
+            version = 5,
+            header_words = 7,
+            row_words = 5
+        };
+
+        struct row {
+            uint32_t const* words;
+            size_t count;
+            int depth;
+            geometry_counts geometry;
+        };
+
+        baked_rows() : words(0), rows(0), commands(0) {}
+
+        // Points at a baked file in memory, which has to stay there and be
+        // 4-byte aligned. Fails if the file is damaged or was baked from
+        // some other level.
+        bool load(void const* data, size_t size,
+                  unsigned char const* level_data, size_t level_size);
+
+        size_t size() const { return rows; }
+        unsigned flags() const { return words ? words[4] : 0; }
+        row operator[](size_t i) const;
+
+    private:
+        uint32_t const* words;
+        size_t rows;
+        uint32_t const* commands;
+    };
+
+    uint32_t level_hash(unsigned char const* level_data, size_t level_size);
+
+    // Generates every row of the level and appends the baked file to out.
+    void bake_rows(level& lvl, unsigned char const* level_data, size_t level_size,
+                   std::vector<uint32_t>& out);
+}
+
+#endif // ROADS_BAKED_ROWS_H
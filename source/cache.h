@@ -46,6 +46,15 @@ extern "C"
     */
     void DC_InvalidateRange(const void *base, uint32_t size);
 
+
+    /*! \fn memUncached(void *address)
+        \brief returns the address of the uncached mirror of main RAM for
+        the given cached main RAM address. Stores through it go straight to
+        memory, so nothing written through it needs to be flushed.
+        \param address address in main RAM.
+    */
+    void* memUncached(void *address);
+
 }
 
 #endif // DSR_CACHE_H_
@@ -1,6 +1,7 @@
 #include "cell.h"
 
 #include "disp_writer.h"
+#include "chunk_arena.h"
 #include "vector.h"
 #include "fixed16.h"
 #include "geometry.h"
@@ -46,8 +47,9 @@ namespace roads {
         return make_rgb(r, g, b);
     }
 
-    disp_writer& operator<<(disp_writer& writer, draw_cell const& drc) {
-        auto saved = writer.save();
+    template <typename Sink>
+    basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, draw_cell const& drc) {
+        writer.begin_transaction();
 
         constexpr f16 block = geometry::draw::block_size;
         constexpr f16 tile = geometry::draw::tile_height;
@@ -59,8 +61,13 @@ namespace roads {
         vector3f16 const offset { drc.position.x, c.altitude * geometry::draw::altitude_step, 0 };
         vector3f16 const back_offset = offset + vector3f16{0, 0, back};
         rgb const ambient = make_rgb(0, 0, 0);
-        rgb const tilec = scale_rgb(tile_color(c), f16(0.5));
-        rgb const blockc = scale_rgb(block_color(c), f16(0.5));
+        int16_t const tilec = scale_rgb(tile_color(c), f16(0.5));
+        int16_t const blockc = scale_rgb(block_color(c), f16(0.5));
+        bool const front = !(drc.hidden & draw_cell::hide_front);
+        bool const shell_left = !(drc.hidden & draw_cell::away_left);
+        bool const shell_right = !(drc.hidden & draw_cell::away_right);
+        bool const left = !drc.coarse && shell_left && !(drc.hidden & draw_cell::hide_left);
+        bool const right = !drc.coarse && shell_right && !(drc.hidden & draw_cell::hide_right);
 
         writer << specular_emission { make_rgb(0, 0, 0), make_rgb(0, 0, 0), false };
 
@@ -79,25 +86,34 @@ namespace roads {
                               offset + vector3f16{ 0,     tile, back } };
             }
 
-            writer
-                // tile front
-                << normal { { 0, 0, 1 } }
-                << quad { offset + vector3f16{ 0,     tile, 0 },
-                          offset + vector3f16{ 0,     0,    0 },
-                          offset + vector3f16{ block, 0,    0 },
-                          offset + vector3f16{ block, tile, 0 } }
-                // tile left side
-                << normal { { -1, 0, 0 } }
-                << quad { offset + vector3f16{ 0,     0, back },
-                          offset + vector3f16{ 0,     0, 0 },
-                          offset + vector3f16{ 0,     tile,  0 },
-                          offset + vector3f16{ 0,     tile,  back } }
-                // tile right side
-                << normal { { 1, 0, 0 } }
-                << quad { offset + vector3f16{ block, tile, back },
-                          offset + vector3f16{ block, tile, 0 },
-                          offset + vector3f16{ block, 0,  0 },
-                          offset + vector3f16{ block, 0,  back } };
+            if(front) {
+                writer
+                    // tile front
+                    << normal { { 0, 0, 1 } }
+                    << quad { offset + vector3f16{ 0,     tile, 0 },
+                              offset + vector3f16{ 0,     0,    0 },
+                              offset + vector3f16{ block, 0,    0 },
+                              offset + vector3f16{ block, tile, 0 } };
+            }
+
+            if(left) {
+                writer
+                    // tile left side
+                    << normal { { -1, 0, 0 } }
+                    << quad { offset + vector3f16{ 0,     0, back },
+                              offset + vector3f16{ 0,     0, 0 },
+                              offset + vector3f16{ 0,     tile,  0 },
+                              offset + vector3f16{ 0,     tile,  back } };
+            }
+            if(right) {
+                writer
+                    // tile right side
+                    << normal { { 1, 0, 0 } }
+                    << quad { offset + vector3f16{ block, tile, back },
+                              offset + vector3f16{ block, tile, 0 },
+                              offset + vector3f16{ block, 0,  0 },
+                              offset + vector3f16{ block, 0,  back } };
+            }
         }
         if(c.flags & cell::tunnel) {
             using geometry::tunnel::inner;
@@ -109,44 +125,55 @@ namespace roads {
                 ? geometry::tunnel::high_outer
                 : geometry::tunnel::outer;
 
-            // front
             writer
-                << diffuse_ambient { blockc, ambient, false }
-                << normal { { 0, 0, 1 } }
-                << quad_strip {
-                    outer[0] + offset, inner[0] + offset,
-                    outer[1] + offset, inner[1] + offset,
-                    outer[2] + offset, inner[2] + offset,
-                    outer[3] + offset, inner[3] + offset,
-                    outer[4] + offset, inner[4] + offset,
-                    outer[5] + offset, inner[5] + offset,
-                    outer[6] + offset, inner[6] + offset,
-                };
+                << diffuse_ambient { blockc, ambient, false };
+
+            // front
+            if(front) {
+                writer
+                    << normal { { 0, 0, 1 } }
+                    << quad_strip {
+                        outer[0] + offset, inner[0] + offset,
+                        outer[1] + offset, inner[1] + offset,
+                        outer[2] + offset, inner[2] + offset,
+                        outer[3] + offset, inner[3] + offset,
+                        outer[4] + offset, inner[4] + offset,
+                        outer[5] + offset, inner[5] + offset,
+                        outer[6] + offset, inner[6] + offset,
+                    };
+            }
 
             // top
 
-            if((c.flags & cell::high) || (c.flags & cell::high)) {
+            if((c.flags & cell::high) || (c.flags & cell::high) || drc.coarse) {
+                if(shell_left) {
+                    writer
+                        << normal { { 1, 0, 0 } }
+                        << quad { outer[0] + back_offset, outer[0] + offset, outer[2] + offset, outer[2] + back_offset };
+                }
                 writer
-                    << normal { { 1, 0, 0 } }
-                    << quad { outer[0] + back_offset, outer[0] + offset, outer[2] + offset, outer[2] + back_offset }
                     << normal { { 0, 1, 0 } }
-                    << quad { outer[2] + back_offset, outer[2] + offset, outer[4] + offset, outer[4] + back_offset }
-                    << normal { {-1, 0, 0 } }
-                    << quad { outer[4] + back_offset, outer[4] + offset, outer[6] + offset, outer[6] + back_offset };
+                    << quad { outer[2] + back_offset, outer[2] + offset, outer[4] + offset, outer[4] + back_offset };
+                if(shell_right) {
+                    writer
+                        << normal { {-1, 0, 0 } }
+                        << quad { outer[4] + back_offset, outer[4] + offset, outer[6] + offset, outer[6] + back_offset };
+                }
             }
             else {
                 using geometry::tunnel::normals;
 
-                writer <<
-                    arc({
-                          { normals[0], outer[0] + back_offset, outer[0] + offset },
-                          { normals[1], outer[1] + back_offset, outer[1] + offset },
-                          { normals[2], outer[2] + back_offset, outer[2] + offset },
-                          { normals[3], outer[3] + back_offset, outer[3] + offset },
-                          { normals[4], outer[4] + back_offset, outer[4] + offset },
-                          { normals[5], outer[5] + back_offset, outer[5] + offset },
-                          { normals[6], outer[6] + back_offset, outer[6] + offset },
-                        });
+                arc_piece const pieces[] = {
+                    { normals[0], outer[0] + back_offset, outer[0] + offset },
+                    { normals[1], outer[1] + back_offset, outer[1] + offset },
+                    { normals[2], outer[2] + back_offset, outer[2] + offset },
+                    { normals[3], outer[3] + back_offset, outer[3] + offset },
+                    { normals[4], outer[4] + back_offset, outer[4] + offset },
+                    { normals[5], outer[5] + back_offset, outer[5] + offset },
+                    { normals[6], outer[6] + back_offset, outer[6] + offset },
+                };
+                // the outermost piece of a side that faces away
+                writer << arc(pieces + !shell_left, pieces + countof(pieces) - !shell_right);
             }
         }
         else if((c.flags & cell::low) || (c.flags & cell::high)) {
@@ -163,31 +190,45 @@ namespace roads {
                 << quad { offset + vector3f16{ 0,     top, 0 },
                           offset + vector3f16{ block, top, 0 },
                           offset + vector3f16{ block, top, back },
-                          offset + vector3f16{ 0,     top, back } }
-                // block front
-                << normal { { 0, 0, 1 } }
-                << quad { offset + vector3f16{ 0,     top,  0 },
-                          offset + vector3f16{ 0,     bottom, 0 },
-                          offset + vector3f16{ block, bottom, 0 },
-                          offset + vector3f16{ block, top,  0 } }
-                // block left side
-                << normal { { -1, 0, 0 } }
-                << quad { offset + vector3f16{ 0,     bottom, back },
-                          offset + vector3f16{ 0,     bottom, 0 },
-                          offset + vector3f16{ 0,     top,  0 },
-                          offset + vector3f16{ 0,     top,  back } }
-                // block right side
-                << normal { { 1, 0, 0 } }
-                << quad { offset + vector3f16{ block, top, back },
-                          offset + vector3f16{ block, top, 0 },
-                          offset + vector3f16{ block, bottom,  0 },
-                          offset + vector3f16{ block, bottom,  back } };
+                          offset + vector3f16{ 0,     top, back } };
+
+            if(front) {
+                writer
+                    // block front
+                    << normal { { 0, 0, 1 } }
+                    << quad { offset + vector3f16{ 0,     top,  0 },
+                              offset + vector3f16{ 0,     bottom, 0 },
+                              offset + vector3f16{ block, bottom, 0 },
+                              offset + vector3f16{ block, top,  0 } };
+            }
+
+            if(left) {
+                writer
+                    // block left side
+                    << normal { { -1, 0, 0 } }
+                    << quad { offset + vector3f16{ 0,     bottom, back },
+                              offset + vector3f16{ 0,     bottom, 0 },
+                              offset + vector3f16{ 0,     top,  0 },
+                              offset + vector3f16{ 0,     top,  back } };
+            }
+            if(right) {
+                writer
+                    // block right side
+                    << normal { { 1, 0, 0 } }
+                    << quad { offset + vector3f16{ block, top, back },
+                              offset + vector3f16{ block, top, 0 },
+                              offset + vector3f16{ block, bottom,  0 },
+                              offset + vector3f16{ block, bottom,  back } };
+            }
 
         }
 
-        if(!writer)
-            writer.reset(saved);
-        return writer;
+        return writer.end_transaction();
     }
 
+    template disp_writer& operator<<(disp_writer&, draw_cell const&);
+    template fifo_disp_writer& operator<<(fifo_disp_writer&, draw_cell const&);
+    template counting_disp_writer& operator<<(counting_disp_writer&, draw_cell const&);
+    template null_disp_writer& operator<<(null_disp_writer&, draw_cell const&);
+    template chunk_disp_writer& operator<<(chunk_disp_writer&, draw_cell const&);
 }
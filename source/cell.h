@@ -44,9 +44,8 @@ namespace roads
     {
             // For two cells c1 and c2 where c2 is further
             // from the camera, draw the face of c2 facing the
-            // camera only if:
-            // c1.altitude != c2.altitude || (c2.flags & elide_flags) > (c1.flags & elide_flags)
-            // ie. the further away one
+            // camera only if c2.face_required(c1), ie. the
+            // further away one
             // a) doesn't have equal altitude to
             // b) has features not hidden by
             // the closer one.
@@ -191,12 +190,59 @@ namespace roads
         // Draw faces facing to the camera only when required:
         // if(far.face_required(near))
         //     draw_z(far);
+        // How far up from its floor the cell is solid all the way across
+        // and all the way along, in steps: nothing, the tile, a short
+        // block, a tall block. A tunnel only counts with its tile, since
+        // there's an opening through it.
+        int solid_level() const
+        {
+            if(!(flags & tunnel) && (flags & high))
+                return 3;
+            if(!(flags & tunnel) && (flags & low))
+                return 2;
+            return (flags & tile) ? 1 : 0;
+        }
+
+        // How far up the faces at the front of the cell reach, in the
+        // same steps. The round and low tunnel shells are as high as a
+        // short block, and the high one as a tall block.
+        int front_level() const
+        {
+            if(flags & tunnel)
+                return (flags & high) ? 3 : 2;
+            return solid_level();
+        }
+
+        // How far up the faces at the sides of the cell reach. Tunnels
+        // only have side faces on their tile.
+        int side_level() const
+        {
+            return (flags & tunnel) ? ((flags & tile) ? 1 : 0) : solid_level();
+        }
+
+        // Whether the faces at the front of this cell can be seen past
+        // near, the cell right in front of it. A tunnel hides another only
+        // if the two openings line up.
         bool face_required(cell near) const
         {
-            return
-                (near.altitude != altitude) ||
-                ((flags & elide_flags) > (near.flags & elide_flags));
-        } 
+            if(near.altitude != altitude)
+                return true;
+            if(near.solid_level() >= front_level())
+                return false;
+            unsigned const shape = tunnel | low | high;
+            bool const same_tunnel = (flags & tunnel)
+                && (near.flags & shape) == (flags & shape)
+                && ((near.flags & tile) || !(flags & tile));
+            return !same_tunnel;
+        }
+
+        // Whether the faces on the side of this cell next to neighbour can
+        // be seen, for a neighbour at least as long as this cell.
+        bool side_required(cell neighbour) const
+        {
+            return neighbour.altitude != altitude
+                || neighbour.solid_level() < side_level();
+        }
 
         static rgb palette[256];
     };
@@ -4,15 +4,32 @@
 #define ROADS_CELLVECTOR_H
 
 namespace roads {
-    struct disp_writer;
+    template <typename Sink> struct basic_disp_writer;
 
     struct draw_cell {
         cell c;
         vector3f16 position;
         vector3f16 scale;
+        // Leaves out the side faces and draws tunnel roofs flat, for when
+        // the full geometry doesn't fit in the frame; see frame_budget.
+        bool coarse;
+        // Faces to leave out because something else covers them, or
+        // because they face away from the camera.
+        unsigned hidden;
+
+        enum {
+            hide_front = 1,
+            hide_left = 2,
+            hide_right = 4,
+            // the whole side faces away, the tunnel shell's too
+            away_left = 8,
+            away_right = 16
+        };
     };
 
-    disp_writer& operator<<(disp_writer& writer, draw_cell const& drc);
+    // Defined in cell.cpp for each of the sinks in disp_sink.h.
+    template <typename Sink>
+    basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, draw_cell const& drc);
 }
 
 #endif // ROADS_CELLVECTOR_H
@@ -0,0 +1,42 @@
+#include <algorithm>
+
+#include "chunk_arena.h"
+#include "cache.h"
+#include "static_list.h"
+
+namespace roads
+{
+    chunk_arena::chunk& chunk_arena::acquire(size_t i)
+    {
+        while(chunks.size() <= i)
+            chunks.push_back(std::unique_ptr<chunk>(new chunk));
+
+        in_use = i + 1;
+        chunks[i]->used = 0;
+        return *chunks[i];
+    }
+
+    size_t chunk_arena::size() const
+    {
+        size_t total = 0;
+        for(size_t i = 0; i < in_use; ++i)
+            total += chunks[i]->used;
+        return total;
+    }
+
+    void chunk_arena::copy_to(uint32_t* out) const
+    {
+        for(size_t i = 0; i < in_use; ++i)
+            out = std::copy(chunks[i]->words, chunks[i]->words + chunks[i]->used, out);
+    }
+
+    void chunk_arena::draw() const
+    {
+        for(size_t i = 0; i < in_use; ++i) {
+            if(chunks[i]->used == 0)
+                continue;
+            DC_FlushRange(chunks[i]->words, chunks[i]->used * 4);
+            draw_words(chunks[i]->words, chunks[i]->used);
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef ROADS_CHUNK_ARENA_H
+#define ROADS_CHUNK_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+namespace roads {
+    /*
+     * Fixed-size chunks of command words for writing lists whose size isn't
+     * known in advance. chunk_sink moves on to a fresh chunk whenever the
+     * next pack doesn't fit in the current one, so every chunk holds whole
+     * packs only and can be sent to the FIFO by itself. A writer on a
+     * chunk_sink therefore never runs out of room and never has to roll
+     * anything back.
+     *
+     * The arena keeps its chunks when it is cleared and hands them out again
+     * to the next list, so after the first few lists writing into it doesn't
+     * allocate at all.
+     */
+    struct chunk_arena {
+        enum { chunk_words = 256 };
+
+        struct chunk {
+            uint32_t words[chunk_words];
+            size_t used;
+        };
+
+        chunk_arena() : in_use(0) {}
+
+        // Forgets the current list; its chunks will be reused.
+        void clear() { in_use = 0; }
+
+        size_t chunk_count() const { return in_use; }
+        chunk const& operator[](size_t i) const { return *chunks[i]; }
+
+        // The number of words in the current list and a way to get them
+        // into one contiguous buffer.
+        size_t size() const;
+        void copy_to(uint32_t* out) const;
+
+        // Sends the current list to the FIFO, one DMA per chunk.
+        void draw() const;
+
+        size_t allocated_chunks() const { return chunks.size(); }
+
+    private:
+        friend struct chunk_sink;
+
+        // Returns the i:th chunk, emptied, with all chunks up to it in use.
+        chunk& acquire(size_t i);
+
+        std::vector<std::unique_ptr<chunk>> chunks;
+        size_t in_use;
+    };
+
+    // A disp_writer sink (see disp_sink.h) that writes into a chunk_arena.
+    // Constructing one starts a new list in the arena.
+    struct chunk_sink {
+        struct position {
+            size_t index, offset, base;
+        };
+        // only a splice of more than a whole chunk can fail
+        enum { bounded = true };
+
+        explicit chunk_sink(chunk_arena& arena)
+            : arena(&arena), index(0), base(0)
+        {
+            arena.clear();
+            current = &arena.acquire(0);
+        }
+
+        bool reserve(size_t count) {
+            if(current->used + count <= chunk_arena::chunk_words)
+                return true;
+            if(count > chunk_arena::chunk_words)
+                return false;
+            base += current->used;
+            current = &arena->acquire(++index);
+            return true;
+        }
+
+        void put(uint32_t word) { current->words[current->used++] = word; }
+        size_t count() const { return base + current->used; }
+        position tell() const { return position { index, current->used, base }; }
+
+        void seek(position p) {
+            index = p.index;
+            base = p.base;
+            current = arena->chunks[index].get();
+            current->used = p.offset;
+            arena->in_use = index + 1;
+        }
+
+    private:
+        chunk_arena* arena;
+        chunk_arena::chunk* current;
+        size_t index;
+        // words in the chunks before the current one
+        size_t base;
+    };
+
+    template <typename Sink> struct basic_disp_writer;
+    typedef basic_disp_writer<chunk_sink> chunk_disp_writer;
+}
+
+#endif // ROADS_CHUNK_ARENA_H
@@ -0,0 +1,172 @@
+#include <algorithm>
+
+#include "command_slab.h"
+
+namespace roads
+{
+    namespace
+    {
+        size_t const none = size_t(-1);
+        // set in the size word of a list that has been freed
+        uint32_t const freed = 0x80000000;
+    }
+
+    slab_list& slab_list::operator=(slab_list&& rhs)
+    {
+        if(this != &rhs) {
+            clear();
+            slab = rhs.slab;
+            ring = rhs.ring;
+            words = rhs.words;
+            count = rhs.count;
+            rhs.slab = 0;
+            rhs.words = 0;
+            rhs.count = 0;
+        }
+        return *this;
+    }
+
+    void slab_list::clear()
+    {
+        if(slab)
+            slab->release(ring, words);
+        slab = 0;
+        words = 0;
+        count = 0;
+    }
+
+    slab_list slab_list::external(uint32_t const* words, size_t count)
+    {
+        slab_list ret;
+        ret.words = const_cast<uint32_t*>(words);
+        ret.count = count;
+        return ret;
+    }
+
+    command_slab::command_slab()
+        : current(none), counters()
+    {
+    }
+
+    slab_list command_slab::allocate(size_t count)
+    {
+        slab_list ret;
+        if(count == 0)
+            return ret;
+
+        size_t offset = none;
+        if(current != none)
+            offset = place(rings[current], count + 1);
+        if(offset == none) {
+            size_t capacity = initial_words;
+            if(current != none) {
+                capacity = rings[current].capacity * 2;
+                if(rings[current].live == 0)
+                    free_ring(current);
+            }
+            while(capacity < count + 1)
+                capacity *= 2;
+            current = acquire(capacity);
+            offset = place(rings[current], count + 1);
+        }
+
+        ring& r = rings[current];
+        r.words[offset] = count;
+        ++r.live;
+        ret.slab = this;
+        ret.ring = current;
+        ret.words = &r.words[offset + 1];
+        ret.count = count;
+
+        counters.live_words += count;
+        counters.peak_live_words = std::max(counters.peak_live_words, counters.live_words);
+        return ret;
+    }
+
+    size_t command_slab::place(ring& r, size_t count)
+    {
+        if(r.used == 0)
+            r.head = r.tail = 0;
+
+        size_t const free = r.capacity - r.used;
+        if(r.head >= r.tail && r.used < r.capacity) {
+            // the free space wraps around the end
+            size_t const end = r.capacity - r.head;
+            if(count > end) {
+                if(count > free - end)
+                    return none;
+                // skip the end, which the size word marks as already freed
+                r.words[r.head] = freed | (end - 1);
+                r.used += end;
+                r.head = 0;
+            }
+        }
+        else if(count > free) {
+            return none;
+        }
+
+        size_t const offset = r.head;
+        r.head = (r.head + count) % r.capacity;
+        r.used += count;
+        return offset;
+    }
+
+    void command_slab::release(size_t index, uint32_t* words)
+    {
+        ring& r = rings[index];
+        counters.live_words -= words[-1];
+        words[-1] |= freed;
+        --r.live;
+
+        if(index != current) {
+            if(r.live == 0)
+                free_ring(index);
+            return;
+        }
+
+        // give back everything from the oldest end up to the first list
+        // still in use
+        while(r.used > 0 && (r.words[r.tail] & freed)) {
+            size_t const n = (r.words[r.tail] & ~freed) + 1;
+            r.used -= n;
+            r.tail = (r.tail + n) % r.capacity;
+        }
+    }
+
+    size_t command_slab::acquire(size_t capacity)
+    {
+        size_t index = 0;
+        while(index < rings.size() && rings[index].words)
+            ++index;
+        if(index == rings.size())
+            rings.push_back(ring());
+
+        ring& r = rings[index];
+        r.words.reset(new uint32_t[capacity]);
+        r.capacity = capacity;
+        r.head = r.tail = r.used = 0;
+        r.live = 0;
+
+        ++counters.rings;
+        counters.resident_words += capacity;
+        counters.peak_resident_words = std::max(counters.peak_resident_words, counters.resident_words);
+        return index;
+    }
+
+    void command_slab::free_ring(size_t index)
+    {
+        ring& r = rings[index];
+        --counters.rings;
+        counters.resident_words -= r.capacity;
+        r.words.reset();
+        r.capacity = 0;
+        if(index == current)
+            current = none;
+    }
+
+    void command_slab::trim()
+    {
+        if(current != none && rings[current].live == 0)
+            free_ring(current);
+    }
+}
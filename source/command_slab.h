@@ -0,0 +1,120 @@
+#ifndef ROADS_COMMAND_SLAB_H
+#define ROADS_COMMAND_SLAB_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+namespace roads {
+    struct command_slab;
+
+    // A finished list of command words allocated from a command_slab. The
+    // words go back to the slab when the list is cleared or destroyed, so
+    // it must not outlive the slab.
+    struct slab_list {
+        slab_list() : slab(0), ring(0), words(0), count(0) {}
+        slab_list(slab_list&& rhs)
+            : slab(rhs.slab), ring(rhs.ring), words(rhs.words), count(rhs.count)
+        {
+            rhs.slab = 0;
+            rhs.words = 0;
+            rhs.count = 0;
+        }
+        slab_list& operator=(slab_list&& rhs);
+        ~slab_list() { clear(); }
+
+        uint32_t* data() { return words; }
+        uint32_t const* data() const { return words; }
+        size_t size() const { return count; }
+
+        void clear();
+
+        // A list over words that belong to someone else, such as a baked
+        // row (see baked_rows.h). Clearing it only forgets them, and they
+        // must not be written through data().
+        static slab_list external(uint32_t const* words, size_t count);
+
+        slab_list(slab_list const&) = delete;
+        slab_list& operator=(slab_list const&) = delete;
+
+    private:
+        friend struct command_slab;
+
+        command_slab* slab;
+        size_t ring;
+        uint32_t* words;
+        size_t count;
+    };
+
+    /*
+     * Memory for the display lists of level rows, which are written once at
+     * their exact size and then only read until they are dropped, in
+     * roughly the order they were made.
+     *
+     * Lists are packed one after another into a single ring, each behind a
+     * word holding its size, and the space is given back from the oldest
+     * end as lists are freed. One freed out of order is only marked, and its
+     * space comes back once every list before it is gone too. A list that
+     * doesn't fit before the end of the ring starts over at the beginning,
+     * and the rest of the ring is skipped. The rows of the visible window
+     * therefore sit next to each other in the order they are drawn, and the
+     * ring only needs to be as big as their geometry.
+     *
+     * When a list doesn't fit at all, the ring is replaced by one twice the
+     * size. The old ring stays until its last list has been freed, and the
+     * level settles on a ring big enough for its window.
+     */
+    struct command_slab {
+        // 16 KiB, which holds the window of each of the test levels
+        enum { initial_words = 4096 };
+
+        struct statistics {
+            size_t live_words;          // in lists that haven't been freed
+            size_t peak_live_words;
+            size_t resident_words;      // in rings held by the slab
+            size_t peak_resident_words;
+            size_t rings;
+        };
+
+        command_slab();
+
+        // An uninitialized list of count words.
+        slab_list allocate(size_t count);
+
+        // Frees the ring if it holds no lists.
+        void trim();
+
+        statistics const& stats() const { return counters; }
+
+        command_slab(command_slab const&) = delete;
+        command_slab& operator=(command_slab const&) = delete;
+
+    private:
+        friend struct slab_list;
+
+        struct ring {
+            std::unique_ptr<uint32_t[]> words;
+            size_t capacity;
+            // where the next list goes, where the oldest one starts, and
+            // the words between them, including the size words and the
+            // skipped ends
+            size_t head, tail, used;
+            size_t live;                // lists not yet freed
+        };
+
+        void release(size_t index, uint32_t* words);
+        // The offset at which a list of count words (size word included)
+        // fits into r, or none.
+        size_t place(ring& r, size_t count);
+        size_t acquire(size_t capacity);
+        void free_ring(size_t index);
+
+        std::vector<ring> rings;
+        // the ring allocations go to, or none
+        size_t current;
+        statistics counters;
+    };
+}
+
+#endif // ROADS_COMMAND_SLAB_H
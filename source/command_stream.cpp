@@ -0,0 +1,230 @@
+#include <algorithm>
+
+#include "command_stream.h"
+#include "display_list.h"
+
+namespace roads
+{
+    int gx_param_count(uint8_t id)
+    {
+        switch(id) {
+        case 0x00: return 0;  // NOP
+        case 0x10: return 1;  // MTX_MODE
+        case 0x11: return 0;  // MTX_PUSH
+        case 0x12: return 1;  // MTX_POP
+        case 0x13: return 1;  // MTX_STORE
+        case 0x14: return 1;  // MTX_RESTORE
+        case 0x15: return 0;  // MTX_IDENTITY
+        case 0x16: return 16; // MTX_LOAD_4x4
+        case 0x17: return 12; // MTX_LOAD_4x3
+        case 0x18: return 16; // MTX_MULT_4x4
+        case 0x19: return 12; // MTX_MULT_4x3
+        case 0x1a: return 9;  // MTX_MULT_3x3
+        case 0x1b: return 3;  // MTX_SCALE
+        case 0x1c: return 3;  // MTX_TRANS
+        case 0x20: return 1;  // COLOR
+        case 0x21: return 1;  // NORMAL
+        case 0x22: return 1;  // TEXCOORD
+        case 0x23: return 2;  // VTX_16
+        case 0x24: return 1;  // VTX_10
+        case 0x25: return 1;  // VTX_XY
+        case 0x26: return 1;  // VTX_XZ
+        case 0x27: return 1;  // VTX_YZ
+        case 0x28: return 1;  // VTX_DIFF
+        case 0x29: return 1;  // POLYGON_ATTR
+        case 0x2a: return 1;  // TEXIMAGE_PARAM
+        case 0x2b: return 1;  // PLTT_BASE
+        case 0x30: return 1;  // DIF_AMB
+        case 0x31: return 1;  // SPE_EMI
+        case 0x32: return 1;  // LIGHT_VECTOR
+        case 0x33: return 1;  // LIGHT_COLOR
+        case 0x34: return 32; // SHININESS
+        case 0x40: return 1;  // BEGIN_VTXS
+        case 0x41: return 0;  // END_VTXS
+        case 0x50: return 1;  // SWAP_BUFFERS
+        case 0x60: return 1;  // VIEWPORT
+        case 0x70: return 3;  // BOX_TEST
+        case 0x71: return 2;  // POS_TEST
+        case 0x72: return 1;  // VEC_TEST
+        default:   return -1;
+        }
+    }
+
+    bool decode_commands(uint32_t const* words, size_t count, std::vector<decoded_command>& out)
+    {
+        size_t i = 0;
+        while(i < count) {
+            uint32_t const pack = words[i++];
+            for(unsigned slot = 0; slot < 4; ++slot) {
+                uint8_t const id = (pack >> (slot * 8)) & 0xFF;
+                if(id == 0)
+                    continue;
+
+                int const params = gx_param_count(id);
+                if(params < 0 || i + params > count)
+                    return false;
+
+                decoded_command const c = { words + i, id, uint8_t(params) };
+                out.push_back(c);
+                i += params;
+            }
+        }
+        return true;
+    }
+
+    geometry_counts count_geometry(uint32_t const* words, size_t count)
+    {
+        geometry_counter counter;
+        size_t i = 0;
+        while(i < count) {
+            uint32_t const pack = words[i++];
+            for(unsigned slot = 0; slot < 4; ++slot) {
+                uint8_t const cmd = (pack >> (slot * 8)) & 0xFF;
+                if(cmd == 0)
+                    continue;
+
+                int const params = gx_param_count(cmd);
+                if(params < 0 || i + params > count)
+                    return counter.counts;
+
+                if(cmd == id(gfx_begin))
+                    counter.begin(words[i] & 3);
+                else if(cmd >= id(gfx_vertex16) && cmd <= id(gfx_vertex_diff))
+                    counter.vertex();
+                i += params;
+            }
+        }
+        return counter.counts;
+    }
+
+    namespace
+    {
+        bool is_matrix(uint8_t cmd)
+        {
+            return cmd >= id(gfx_matrix_mode) && cmd <= id(gfx_matrix_trans);
+        }
+
+        // Commands whose effect doesn't depend on the current matrices.
+        bool ignores_matrices(uint8_t cmd)
+        {
+            switch(cmd) {
+            case id(gfx_color):
+            case id(gfx_diffuse_ambient):
+            case id(gfx_specular_emission):
+            case id(gfx_light_color):
+            case id(gfx_shininess):
+            case id(gfx_begin):
+            case id(gfx_end):
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        bool is_material(uint8_t cmd)
+        {
+            switch(cmd) {
+            case id(gfx_diffuse_ambient):
+            case id(gfx_specular_emission):
+            case id(gfx_light_color):
+            case id(gfx_shininess):
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        bool is_primitive(uint8_t cmd)
+        {
+            return cmd == id(gfx_begin) || cmd == id(gfx_end);
+        }
+    }
+
+    bool commands_commute(uint8_t a, uint8_t b)
+    {
+        if(a == b)
+            return false;
+        if(is_matrix(a))
+            return ignores_matrices(b);
+        if(is_matrix(b))
+            return ignores_matrices(a);
+        // The material is only used when a normal is sent, and the vertex
+        // color only when a vertex is; neither cares about begin and end.
+        // (gfx_color and gfx_diffuse_ambient both may set the vertex color,
+        // so they don't commute.)
+        if(is_material(a) && is_material(b))
+            return true;
+        if(is_primitive(a))
+            return is_material(b) || b == id(gfx_color);
+        if(is_primitive(b))
+            return is_material(a) || a == id(gfx_color);
+        return false;
+    }
+
+    void encode_commands(std::vector<decoded_command>& commands, std::vector<uint32_t>& out)
+    {
+        size_t i = 0;
+        size_t const n = commands.size();
+        while(i < n) {
+            size_t const header = out.size();
+            out.push_back(0);
+
+            uint32_t pack = 0;
+            size_t slot = 0;
+            for(; slot < 4 && i < n; ++slot) {
+                // See paragraph (2) in disp_writer::flush_pipe.
+                if(slot == 3 && commands[i].pcount == 0) {
+                    if(i + 1 < n && commands[i + 1].pcount > 0
+                    && commands_commute(commands[i].id, commands[i + 1].id)) {
+                        std::swap(commands[i], commands[i + 1]);
+                    }
+                    else {
+                        break;
+                    }
+                }
+
+                decoded_command const& c = commands[i++];
+                pack |= uint32_t(c.id) << (slot * 8);
+                for(size_t j = 0; j < c.pcount; ++j)
+                    out.push_back(c.params[j]);
+            }
+
+            // pad with nops, each with a zero parameter like disp_writer's
+            for(; slot < 4; ++slot)
+                out.push_back(0);
+
+            out[header] = pack;
+        }
+    }
+
+    size_t optimize(std::vector<uint32_t>& words)
+    {
+        std::vector<decoded_command> commands;
+        if(words.empty() || !decode_commands(&words[0], words.size(), commands))
+            return 0;
+
+        std::vector<uint32_t> packed;
+        packed.reserve(words.size());
+        encode_commands(commands, packed);
+        if(packed.size() >= words.size())
+            return 0;
+
+        size_t const saved = words.size() - packed.size();
+        words.swap(packed);
+        return saved;
+    }
+
+    size_t optimize(display_list& lst)
+    {
+        if(lst.size() == 0)
+            return 0;
+
+        std::vector<uint32_t> words(lst.data(), lst.data() + lst.size());
+        size_t const saved = optimize(words);
+        if(saved > 0) {
+            std::copy(words.begin(), words.end(), lst.data());
+            lst.resize(words.size());
+        }
+        return saved;
+    }
+}
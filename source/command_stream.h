@@ -0,0 +1,53 @@
+#ifndef ROADS_COMMAND_STREAM_H
+#define ROADS_COMMAND_STREAM_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+#include "glcore.h"
+#include "frame_budget.h"
+
+namespace roads {
+    struct display_list;
+
+    // Number of parameter words that follow the command with the given id
+    // (as packed by fifo_pack), or -1 for ids the hardware doesn't know.
+    int gx_param_count(uint8_t id);
+
+    // One command of a packed list, with its parameters still in the list.
+    struct decoded_command {
+        uint32_t const* params;
+        uint8_t id;
+        uint8_t pcount;
+    };
+
+    // Splits a packed list into its commands the same way the hardware
+    // does: every header is followed by the parameters of its non-nop
+    // commands, and a zero word where a header is expected is just an empty
+    // header. Nops are left out. Returns false if the list ends in the middle
+    // of a command or contains an unknown one.
+    bool decode_commands(uint32_t const* words, size_t count, std::vector<decoded_command>& out);
+
+    // The polygons and vertices a packed list submits. Stops at the first
+    // unknown or truncated command.
+    geometry_counts count_geometry(uint32_t const* words, size_t count);
+
+    // Packs commands four to a header, following the same rules as
+    // disp_writer::flush_pipe, except that a parameterless command that would
+    // land in the top-most slot is first swapped with the command after it
+    // when the two can be executed in either order. Only when that's not
+    // possible does a nop take the slot.
+    void encode_commands(std::vector<decoded_command>& commands, std::vector<uint32_t>& out);
+
+    // Whether the geometry engine ends up in the same state whichever order
+    // the two commands are executed in.
+    bool commands_commute(uint8_t a, uint8_t b);
+
+    // Rewrites a finished list without the nops that disp_writer had to pad
+    // its packs with. The list is only changed if that makes it shorter;
+    // returns the number of words saved.
+    size_t optimize(display_list& lst);
+    size_t optimize(std::vector<uint32_t>& words);
+}
+
+#endif // ROADS_COMMAND_STREAM_H
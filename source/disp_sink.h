@@ -0,0 +1,109 @@
+#ifndef ROADS_DISP_SINK_H
+#define ROADS_DISP_SINK_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "glcore.h"
+
+namespace roads {
+    /*
+     * Sinks receive the packed words that basic_disp_writer produces. A sink
+     * provides:
+     *
+     *     bool reserve(size_t count);         // can count more words be put
+     *                                         // without splitting them up?
+     *     void put(uint32_t word);
+     *     size_t count() const;               // words put so far
+     *     position tell() const;              // for save() and reset()
+     *     void seek(position);
+     *     enum { bounded = ... };             // can reserve ever fail?
+     *
+     * The writer only ever calls seek to roll back to a position it got from
+     * tell, after which it overwrites whatever came after.
+     */
+
+    // Writes into a bounded uint32_t range. This is what display lists are
+    // built with.
+    struct buffer_sink {
+        typedef uint32_t* iterator;
+        typedef uint32_t* position;
+        enum { bounded = true };
+
+        buffer_sink(iterator start, iterator end)
+            : start(start), pos(start), end(end) {}
+
+        bool reserve(size_t count) { return size_t(end - pos) >= count; }
+        void put(uint32_t word) { *pos++ = word; }
+        size_t count() const { return pos - start; }
+        position tell() const { return pos; }
+        void seek(position p) { pos = p; }
+
+        void reseat(iterator new_start, iterator new_end) {
+            start = pos = new_start;
+            end = new_end;
+        }
+
+    private:
+        iterator start, pos, end;
+    };
+
+    // Streams words straight into the geometry engine's command FIFO, for
+    // dynamic geometry that is drawn once and thrown away. Words that have
+    // been sent can't be taken back, so seek only works within what is
+    // still in the writer's pipe; since the FIFO never runs out of room the
+    // writer has no reason to roll back further than that anyway.
+    struct fifo_sink {
+        typedef size_t position;
+        enum { bounded = false };
+
+        fifo_sink() : sent(0) {}
+
+        bool reserve(size_t) { return true; }
+        void put(uint32_t word) {
+#ifdef ARM9
+            *detail::io_pointer<uint32_t volatile*>(gfx_address_base + gfx_fifo) = word;
+#else
+            host::write_gx_fifo(word);
+#endif
+            ++sent;
+        }
+        size_t count() const { return sent; }
+        position tell() const { return sent; }
+        void seek(position) {}
+
+    private:
+        size_t sent;
+    };
+
+    // Only counts the words, so that a list can be measured before the
+    // buffer for it is allocated.
+    struct counting_sink {
+        typedef size_t position;
+        enum { bounded = false };
+
+        counting_sink() : words(0) {}
+
+        bool reserve(size_t) { return true; }
+        void put(uint32_t) { ++words; }
+        size_t count() const { return words; }
+        position tell() const { return words; }
+        void seek(position p) { words = p; }
+
+    private:
+        size_t words;
+    };
+
+    // Throws everything away; for measuring the cost of the writer itself.
+    struct null_sink {
+        typedef int position;
+        enum { bounded = false };
+
+        bool reserve(size_t) { return true; }
+        void put(uint32_t) {}
+        size_t count() const { return 0; }
+        position tell() const { return 0; }
+        void seek(position) {}
+    };
+}
+
+#endif // ROADS_DISP_SINK_H
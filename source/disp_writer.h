@@ -1,6 +1,7 @@
 #ifndef ROADS_DISP_WRITER_H
 #define ROADS_DISP_WRITER_H
 
+#include <algorithm>
 #include <cstdint>
 #include <cassert>
 #include <initializer_list>
@@ -9,6 +10,11 @@
 #include "fixed16.h"
 #include "vector.h"
 #include "display_list.h"
+#include "disp_sink.h"
+#include "static_list.h"
+#include "frame_budget.h"
+#include "command_stream.h"
+#include "strip_builder.h"
 
 namespace roads {
     /*
@@ -43,9 +49,52 @@ namespace roads {
      * will not be cleared out, but the write pointer of the disp_writer will
      * be reset so that it overwrites them on further writes.
      *
+     * The inserters below do the same with begin_transaction and
+     * end_transaction, which nest and, unlike save, only record what they
+     * can't rebuild after a rollback; see begin_transaction.
+     *
+     * Consecutive quads (or triangles) share a single gfx_begin unless
+     * batching has been turned off with set_batching(false); see begin().
+     *
+     * Likewise, normals, materials and colors that are identical to what
+     * was last written are left out unless the state cache has been turned
+     * off with set_state_cache(false); see set_state().
+     *
+     * Vertices are written with the smallest encoding that reproduces them
+     * exactly given the previous vertex, unless that has been turned off
+     * with set_compact_vertices(false); see write_vertex().
+     *
+     * disp_writer writes into a buffer. The same commands can be sent to any
+     * of the sinks in disp_sink.h instead, for example to find out how big a
+     * list is going to be before allocating it:
+     *
+     *     counting_disp_writer counter(counting_sink(), translation, scale);
+     *     counter << stuff << end;
+     *     lst.resize(counter.write_count());
+     *     disp_writer writer(lst, translation, scale);
+     *     writer << stuff << end;
+     *
+     * The writer also counts the polygons and vertices it has written, for
+     * charging the list to a frame_budget; see geometry().
+     *
+     * Quads that share edges can be joined into quad strips by handing the
+     * writer a strip_builder; see set_strip_builder().
+     *
+     * Parameters that change after the list has been written, such as where
+     * an object is or what color it is, can be recorded in a patch_slot and
+     * then changed in place with display_list::patch:
+     *
+     *     patch_slot where = writer.translation_slot();
+     *     patch_slot tint;
+     *     writer << patchable(tint) << color { red } << stuff << end;
+     *     ...
+     *     lst.patch(where, position);
+     *     lst.patch(tint, blue);
+     *
      */
 
-    struct disp_writer {
+    template <typename Sink>
+    struct basic_disp_writer {
         typedef uint32_t* iterator;
 
         enum {
@@ -63,16 +112,74 @@ namespace roads {
             uint32_t params[2];
             gfx_offset_t offset;
             uint8_t pcount;
+            // where to record the position of the parameters, or null
+            patch_slot* patch;
         } pipe[4];
 
+        // Shadow copies of the geometry engine state that set_state can
+        // elide. A value is only meaningful if its bit is set in valid.
+        struct shadow_state {
+            enum {
+                normal = 1,
+                diffuse_ambient = 2,
+                specular_emission = 4,
+                color = 8,
+                vertex = 16
+            };
+            uint32_t values[4];
+            int16_t vertex_raw[3];
+            unsigned valid;
+        };
+
+        // The state the user has asked for while quads are being held back
+        // for a strip_builder. Values in pending have not been written yet.
+        struct requested_state {
+            uint32_t values[4];
+            unsigned valid, pending;
+        };
+
         struct reset_data {
             cmd pipe[4];
-            iterator buffer_pos;
+            typename Sink::position sink_pos;
             size_t pipe_index;
+            int primitive;
+            shadow_state shadow;
+            geometry_counter counter;
+            requested_state requested;
+            size_t strip_faces;
         };
 
         reset_data save() {
-            return reset_data { { pipe[0], pipe[1], pipe[2], pipe[3] }, buffer_pos, pipe_index };
+            return reset_data { { pipe[0], pipe[1], pipe[2], pipe[3] }, sink.tell(), pipe_index, primitive, shadow, counter,
+                                requested, strips ? strips->size() : 0 };
+        }
+
+        // Starts a group of writes that is rolled back as a whole if the
+        // buffer fills up before the matching end_transaction. Transactions
+        // nest, and only the outermost one records anything, since a failure
+        // anywhere inside it makes the whole group fail. Nothing at all is
+        // recorded for sinks that never run out of room.
+        //
+        // Unlike save, a transaction only takes the sink position and the
+        // pipe index up front. The commands still in the pipe and the
+        // geometry counts are kept when the first flush is about to
+        // overwrite them, and the strip_builder state when the first state
+        // or face is about to be added to it. The shadow state and the
+        // primitive are not kept at all: a rollback forgets them, which
+        // costs a few redundant commands after the rare rollback instead of
+        // a copy on every transaction.
+        void begin_transaction() {
+            if(transaction_depth++ == 0 && Sink::bounded) {
+                started.sink_pos = sink.tell();
+                started.pipe_index = pipe_index;
+                started.kept = 0;
+            }
+        }
+
+        basic_disp_writer& end_transaction() {
+            if(--transaction_depth == 0 && Sink::bounded && buffer_full)
+                roll_back();
+            return *this;
         }
 
         void reset(reset_data const& data) {
@@ -80,8 +187,14 @@ namespace roads {
             pipe[1] = data.pipe[1];
             pipe[2] = data.pipe[2];
             pipe[3] = data.pipe[3];
-            buffer_pos = data.buffer_pos;
+            sink.seek(data.sink_pos);
             pipe_index = data.pipe_index;
+            primitive = data.primitive;
+            shadow = data.shadow;
+            counter = data.counter;
+            requested = data.requested;
+            if(strips && data.strip_faces < strips->size())
+                strips->truncate(data.strip_faces);
         }
 
         // Returns false if the buffer has become full. You can test a writer's
@@ -100,17 +213,282 @@ namespace roads {
         }
 
         size_t write_count() {
-            return buffer_pos - buffer_start;
+            return sink.count();
+        }
+
+        Sink& get_sink() {
+            return sink;
+        }
+
+        // The polygons and vertices written so far, as the geometry engine
+        // will assemble them.
+        geometry_counts geometry() const {
+            geometry_counter c = counter;
+            for(size_t i = 0; i < pipe_index; ++i)
+                count(c, pipe[i]);
+            return c.counts;
+        }
+
+        void set_batching(bool enable) {
+            batching = enable;
+            primitive = no_primitive;
+        }
+
+        void set_state_cache(bool enable) {
+            caching = enable;
+            shadow.valid &= shadow_state::vertex;
+        }
+
+        void set_compact_vertices(bool enable) {
+            compacting = enable;
+            shadow.valid &= ~shadow_state::vertex;
+        }
+
+        // While a strip_builder is set, quads are added to it instead of
+        // being written, and normals and materials are only written when
+        // something other than a quad needs them. The quads are written at
+        // the end of the list (or when the builder is changed), joined into
+        // strips wherever they share an edge. Passing null turns this off.
+        //
+        // Held-back state is written in the order specular/emission,
+        // diffuse/ambient, color, normal, which is the order that lights a
+        // vertex the same way as any order the user could have written it in
+        // as long as each normal comes after the material it is lit with.
+        void set_strip_builder(strip_builder* builder) {
+            write_strips();
+            strips = builder;
+            requested.valid = requested.pending = 0;
+            if(strips)
+                strips->clear();
+        }
+
+        strip_builder* get_strip_builder() {
+            return strips;
+        }
+
+        // The translation the list was started with, as three words.
+        patch_slot translation_slot() const {
+            return prelude_translation;
+        }
+
+        // Records where the parameters of the next command end up in slot,
+        // once the command has been written out. For normals, materials and
+        // colors, which are what this is meant for, the state cache neither
+        // leaves that command out nor relies on its value afterwards. The
+        // slot is meaningless if the writer runs out of room or the list is
+        // repacked, and it can't be used with a strip_builder, which holds
+        // state back.
+        basic_disp_writer& patch_next(patch_slot& slot) {
+            assert(!strips);
+            next_patch = &slot;
+            return *this;
+        }
+
+        // Adds a quad to the strip_builder with the state requested so far.
+        basic_disp_writer& add_face(vector3f16 a, vector3f16 b, vector3f16 c, vector3f16 d) {
+            keep_strips();
+            strip_builder::face f = { { a, b, c, d } };
+            for(size_t i = 0; i < 4; ++i)
+                f.state[i] = requested.values[i];
+            f.valid = requested.valid;
+            strips->add(f);
+            return *this;
         }
 
     private:
-        iterator buffer_start, buffer_pos, buffer_end;
+        enum { no_primitive = -1 };
+
+        Sink sink;
         size_t pipe_index;
 
         bool buffer_full;
 
+        // The primitive type of the last gfx_begin we wrote, or no_primitive
+        // if the next primitive must start with a gfx_begin of its own.
+        int primitive;
+        bool batching;
+
+        shadow_state shadow;
+        bool caching;
+        bool compacting;
+
+        // Counts the commands as they are flushed, so that it only changes
+        // when the sink does; see geometry().
+        geometry_counter counter;
+
+        strip_builder* strips;
+        requested_state requested;
+
+        // What the outermost transaction started from; see
+        // begin_transaction. Only the members named by the bits in kept
+        // are meaningful.
+        struct transaction_start {
+            enum {
+                kept_pipe = 1,  // pipe (up to pipe_index) and counter
+                kept_strips = 2 // requested and strip_faces
+            };
+            typename Sink::position sink_pos;
+            size_t pipe_index;
+            unsigned kept;
+            cmd pipe[4];
+            geometry_counter counter;
+            requested_state requested;
+            size_t strip_faces;
+        } started;
+        unsigned transaction_depth;
+
+        patch_slot* next_patch;
+        patch_slot prelude_translation;
+
+        static void count(geometry_counter& c, cmd const& command) {
+            if(command.offset == gfx_begin)
+                c.begin(command.params[0]);
+            else if(command.offset >= gfx_vertex16 && command.offset <= gfx_vertex_diff)
+                c.vertex();
+        }
+
+        void keep_pipe() {
+            if(Sink::bounded && transaction_depth && !(started.kept & transaction_start::kept_pipe)) {
+                started.kept |= transaction_start::kept_pipe;
+                std::copy(pipe, pipe + started.pipe_index, started.pipe);
+                started.counter = counter;
+            }
+        }
+
+        void keep_strips() {
+            if(Sink::bounded && transaction_depth && !(started.kept & transaction_start::kept_strips)) {
+                started.kept |= transaction_start::kept_strips;
+                started.requested = requested;
+                started.strip_faces = strips->size();
+            }
+        }
+
+        void roll_back() {
+            sink.seek(started.sink_pos);
+            if(started.kept & transaction_start::kept_pipe) {
+                std::copy(started.pipe, started.pipe + started.pipe_index, pipe);
+                counter = started.counter;
+            }
+            pipe_index = started.pipe_index;
+            if(started.kept & transaction_start::kept_strips) {
+                requested = started.requested;
+                if(strips && started.strip_faces < strips->size())
+                    strips->truncate(started.strip_faces);
+            }
+            // Nothing written since the checkpoint reaches the geometry
+            // engine, so whatever is known about its state may be stale:
+            // the next primitive gets its own gfx_begin and the next state
+            // commands are all written.
+            primitive = no_primitive;
+            shadow.valid = 0;
+            requested.pending = requested.valid;
+        }
+
+        static unsigned shadow_bit(gfx_offset_t cmd) {
+            switch(cmd) {
+            case gfx_normal:            return shadow_state::normal;
+            case gfx_diffuse_ambient:   return shadow_state::diffuse_ambient;
+            case gfx_specular_emission: return shadow_state::specular_emission;
+            case gfx_color:             return shadow_state::color;
+            default:                    return 0;
+            }
+        }
+
+        static size_t shadow_index(unsigned bit) {
+            return bit == shadow_state::normal ? 0
+                 : bit == shadow_state::diffuse_ambient ? 1
+                 : bit == shadow_state::specular_emission ? 2
+                 : 3;
+        }
+
+        // Writes the values in state that are set in valid, materials
+        // before normals.
+        void write_states(uint32_t const* values, unsigned valid) {
+            static gfx_offset_t const order[] = {
+                gfx_specular_emission, gfx_diffuse_ambient, gfx_color, gfx_normal
+            };
+            for(size_t i = 0; i < 4; ++i) {
+                unsigned const bit = shadow_bit(order[i]);
+                if(valid & bit)
+                    write_state(order[i], values[shadow_index(bit)]);
+            }
+        }
+
+        void write_requested() {
+            write_states(requested.values, requested.pending);
+            requested.pending = 0;
+        }
+
+        // Writes out the quads held back for the strip_builder.
+        void write_strips() {
+            if(!strips || strips->size() == 0)
+                return;
+
+            // the quads are written with the state they were added with,
+            // not through the builder again
+            strip_builder* const builder = strips;
+            strips = 0;
+            builder->build();
+            for(auto const& r : builder->runs()) {
+                strip_builder::face const& f = builder->faces()[r.face];
+                write_states(f.state, f.valid);
+                begin(r.count > 1 ? gl_quad_strip : gl_quads);
+                size_t const count = r.count > 1 ? 2 * r.count + 2 : 4;
+                for(size_t i = 0; i < count; ++i)
+                    write_vertex(builder->vertices()[r.first_vertex + i]);
+            }
+            strips = builder;
+
+            // keep the faces if we ran out of room so that they can be
+            // rolled back
+            if(*this) {
+                strips->clear();
+                requested.pending = requested.valid;
+            }
+        }
+
+        // Drops whatever shadow state the given command changes. The vertex
+        // color is computed when a normal is sent, from the material, the
+        // lights and the vector matrix as they are at that moment, so a
+        // change to any of those means the same normal has to be sent again
+        // to get the same color.
+        void forget(gfx_offset_t cmd) {
+            switch(cmd) {
+            case gfx_normal:
+                shadow.valid &= ~(shadow_state::normal | shadow_state::color);
+                break;
+            case gfx_diffuse_ambient:
+                // may also set the vertex color
+                shadow.valid &= ~(shadow_state::diffuse_ambient | shadow_state::normal | shadow_state::color);
+                break;
+            case gfx_specular_emission:
+                shadow.valid &= ~(shadow_state::specular_emission | shadow_state::normal);
+                break;
+            case gfx_color:
+                shadow.valid &= ~(shadow_state::color | shadow_state::normal);
+                break;
+            case gfx_light_vector:
+            case gfx_light_color:
+            case gfx_shininess:
+                shadow.valid &= ~shadow_state::normal;
+                break;
+            case gfx_vertex16:
+            case gfx_vertex10:
+            case gfx_vertex_xy:
+            case gfx_vertex_xz:
+            case gfx_vertex_yz:
+            case gfx_vertex_diff:
+                shadow.valid &= ~shadow_state::vertex;
+                break;
+            default:
+                if(cmd >= gfx_matrix_mode && cmd <= gfx_matrix_trans)
+                    shadow.valid &= ~shadow_state::normal;
+                break;
+            }
+        }
+
         void append(uint32_t value) {
-            *buffer_pos++ = value;
+            sink.put(value);
         }
 
     public:
@@ -124,12 +502,17 @@ namespace roads {
         // command MUST have parameters" so if we get a command with zero
         // parameters in that slot, we will put a nop in that command's place
         // and defer the actual command to the next flush.
-        disp_writer& flush_pipe() {
+        basic_disp_writer& flush_pipe() {
+            // The commands that were in the pipe when the transaction
+            // started are about to be overwritten.
+            keep_pipe();
+
             // Insert nops if we don't have a full pack of four commands.
             for(size_t i = pipe_index; i < 4; ++i) {
                 pipe[i].offset = gfx_nop;
                 pipe[i].pcount = 1;
                 pipe[i].params[0] = 0;
+                pipe[i].patch = 0;
             }
 
             pipe_index = 4;
@@ -144,13 +527,14 @@ namespace roads {
                 pipe[3].offset = gfx_nop;
                 pipe[3].pcount = 1;
                 pipe[3].params[0] = 0;
+                pipe[3].patch = 0;
             }
 
             // Check if we have enough space left in the buffer. If we don't,
             // set the buffer_full flag, restore any deferred command and
             // return early.
             ptrdiff_t size_needed = 1 /* pack */ + pipe[0].pcount + pipe[1].pcount + pipe[2].pcount + pipe[3].pcount;
-            if(buffer_end - buffer_pos < size_needed) {
+            if(!sink.reserve(size_needed)) {
                 if(defer) {
                     pipe[3] = deferred;
                 }
@@ -161,8 +545,13 @@ namespace roads {
             uint32_t pack = fifo_pack(pipe[0].offset, pipe[1].offset, pipe[2].offset, pipe[3].offset);
             append(pack);
             for(size_t i = 0; i < 4; ++i) {
+                if(pipe[i].patch) {
+                    pipe[i].patch->offset = sink.count();
+                    pipe[i].patch->count = pipe[i].pcount;
+                }
                 for(size_t j = 0; j < pipe[i].pcount; ++j)
                     append(pipe[i].params[j]);
+                count(counter, pipe[i]);
             }
 
             // See paragraph (2) above. 0 is an invalid command.
@@ -179,45 +568,192 @@ namespace roads {
 
         // The user can call this function with a new buffer to continue
         // writing after a buffer has been filled.
-        disp_writer& reseat_buffer(iterator new_buffer_start, iterator new_buffer_end) {
-            buffer_start = buffer_pos = new_buffer_start;
-            buffer_end = new_buffer_end;
+        basic_disp_writer& reseat_buffer(iterator new_buffer_start, iterator new_buffer_end) {
+            sink.reseat(new_buffer_start, new_buffer_end);
             buffer_full = false;
             return *this;
         }
 
-        disp_writer& push(gfx_offset_t cmd) {
+        basic_disp_writer& push(gfx_offset_t cmd) {
             if(pipe_index == 4 && !flush_pipe())
                 return *this;
+            forget(cmd);
             pipe[pipe_index].offset = cmd;
             pipe[pipe_index].pcount = 0;
+            pipe[pipe_index].patch = 0;
             ++pipe_index;
             return *this;
         }
 
-        disp_writer& push(gfx_offset_t cmd, uint32_t param0) {
+        basic_disp_writer& push(gfx_offset_t cmd, uint32_t param0) {
             if(pipe_index == 4 && !flush_pipe())
                 return *this;
+            forget(cmd);
             pipe[pipe_index].offset = cmd;
             pipe[pipe_index].pcount = 1;
             pipe[pipe_index].params[0] = param0;
+            pipe[pipe_index].patch = next_patch;
+            next_patch = 0;
             ++pipe_index;
             return *this;
         }
 
-        disp_writer& push(gfx_offset_t cmd, uint32_t param0, uint32_t param1) {
+        basic_disp_writer& push(gfx_offset_t cmd, uint32_t param0, uint32_t param1) {
             if(pipe_index == 4 && !flush_pipe())
                 return *this;
+            forget(cmd);
             pipe[pipe_index].offset = cmd;
             pipe[pipe_index].pcount = 2;
             pipe[pipe_index].params[0] = param0;
             pipe[pipe_index].params[1] = param1;
+            pipe[pipe_index].patch = next_patch;
+            next_patch = 0;
             ++pipe_index;
             return *this;
         }
 
+        // Writes one of gfx_normal, gfx_diffuse_ambient, gfx_specular_emission
+        // or gfx_color, unless the state cache is on and the geometry engine
+        // is known to already have that exact value. With a strip_builder
+        // set, the value is only recorded; see set_strip_builder().
+        basic_disp_writer& set_state(gfx_offset_t cmd, uint32_t value) {
+            if(!strips)
+                return write_state(cmd, value);
+
+            keep_strips();
+            unsigned const bit = shadow_bit(cmd);
+            requested.values[shadow_index(bit)] = value;
+            requested.valid |= bit;
+            requested.pending |= bit;
+            // diffuse_ambient with bit 15 set also sets the vertex color
+            if(cmd == gfx_diffuse_ambient && (value & (1 << 15))) {
+                requested.values[shadow_index(shadow_state::color)] = value & 0x7FFF;
+                requested.valid |= shadow_state::color;
+                requested.pending &= ~shadow_state::color;
+            }
+            return *this;
+        }
+
+    private:
+        basic_disp_writer& write_state(gfx_offset_t cmd, uint32_t value) {
+            unsigned const bit = shadow_bit(cmd);
+            uint32_t& shadowed = shadow.values[shadow_index(bit)];
+            // a patchable value can change at any time
+            bool const patchable = next_patch != 0;
+            if(caching && !patchable && (shadow.valid & bit) && shadowed == value)
+                return *this;
+            push(cmd, value);
+            if(caching && !patchable && *this) {
+                shadowed = value;
+                shadow.valid |= bit;
+                // diffuse_ambient with bit 15 set also sets the vertex color
+                if(cmd == gfx_diffuse_ambient && (value & (1 << 15))) {
+                    shadow.values[shadow_index(shadow_state::color)] = value & 0x7FFF;
+                    shadow.valid |= shadow_state::color;
+                }
+            }
+            return *this;
+        }
+
+    public:
+        // Appends words that have already been packed, such as the contents
+        // of a static_list. Anything still in the pipe is flushed first, and
+        // since the appended commands are not looked at, the writer forgets
+        // everything it knew about the geometry engine state. The caller
+        // tells how much geometry the words contain.
+        basic_disp_writer& splice(uint32_t const* words, size_t count, geometry_counts const& geometry = geometry_counts()) {
+            write_strips();
+            while(pipe_index > 0) {
+                if(!flush_pipe())
+                    return *this;
+            }
+            if(!sink.reserve(count)) {
+                buffer_full = true;
+                return *this;
+            }
+            for(size_t i = 0; i < count; ++i)
+                append(words[i]);
+            primitive = no_primitive;
+            shadow.valid = 0;
+            counter.counts += geometry;
+            counter.begin(geometry_counter::no_primitive);
+            requested.pending = requested.valid;
+            return *this;
+        }
+
+        // Writes a vertex. The one-parameter encodings are used when they
+        // give exactly the same position: xy, xz and yz keep one coordinate
+        // of the previous vertex, diff adds a -512..511 raw 4.12 offset to it
+        // and vertex10 drops the six low fraction bits of each coordinate.
+        // Everything else takes the two-parameter gfx_vertex16.
+        basic_disp_writer& write_vertex(vector3f16 v) {
+            if(strips && requested.pending)
+                write_requested();
+
+            int16_t const x = raw(v.x), y = raw(v.y), z = raw(v.z);
+
+            if(!compacting)
+                return push(gfx_vertex16, vertex_pack(v.x, v.y), vertex_pack(v.z, 0));
+
+            auto pack10 = [](int32_t a, int32_t b, int32_t c) {
+                return (uint32_t(a) & 0x3FF) | ((uint32_t(b) & 0x3FF) << 10) | ((uint32_t(c) & 0x3FF) << 20);
+            };
+            auto pack16 = [](int16_t a, int16_t b) {
+                return (uint32_t(a) & 0xFFFF) | (uint32_t(b) << 16);
+            };
+
+            if(shadow.valid & shadow_state::vertex) {
+                int16_t const* prev = shadow.vertex_raw;
+                int32_t const dx = x - prev[0], dy = y - prev[1], dz = z - prev[2];
+
+                if(dz == 0)
+                    push(gfx_vertex_xy, pack16(x, y));
+                else if(dy == 0)
+                    push(gfx_vertex_xz, pack16(x, z));
+                else if(dx == 0)
+                    push(gfx_vertex_yz, pack16(y, z));
+                else if(dx >= -512 && dx < 512 && dy >= -512 && dy < 512 && dz >= -512 && dz < 512)
+                    push(gfx_vertex_diff, pack10(dx, dy, dz));
+                else if(((x | y | z) & 0x3F) == 0)
+                    push(gfx_vertex10, pack10(x >> 6, y >> 6, z >> 6));
+                else
+                    push(gfx_vertex16, pack16(x, y), pack16(z, 0));
+            }
+            else if(((x | y | z) & 0x3F) == 0) {
+                push(gfx_vertex10, pack10(x >> 6, y >> 6, z >> 6));
+            }
+            else {
+                push(gfx_vertex16, pack16(x, y), pack16(z, 0));
+            }
+
+            if(*this) {
+                shadow.vertex_raw[0] = x;
+                shadow.vertex_raw[1] = y;
+                shadow.vertex_raw[2] = z;
+                shadow.valid |= shadow_state::vertex;
+            }
+            return *this;
+        }
+
+        // Starts a primitive of the given type. The geometry engine keeps
+        // assembling quads out of every four vertices (or triangles out of
+        // every three) until the next gfx_begin, so when batching is on and
+        // the previous primitive was of the same independent type, we can
+        // leave the gfx_begin out entirely. Strips always need a gfx_begin
+        // to start a new strip.
+        basic_disp_writer& begin(gl_begin_t type) {
+            bool const independent = type == gl_quads || type == gl_triangles;
+            if(batching && independent && primitive == type)
+                return *this;
+            push(gfx_begin, type);
+            if(*this)
+                primitive = batching ? int(type) : int(no_primitive);
+            return *this;
+        }
+
     private:
         void push_prelude(vector3f32 const& pos, vector3f32 const& scale) {
+            sink.reserve(min_buffer_length);
             append(fifo_pack(gfx_matrix_push, gfx_matrix_mult_4x3, gfx_nop, gfx_nop));
             // no params for push or identity
 
@@ -225,6 +761,8 @@ namespace roads {
             append(raw(scale.x)); append(           0); append(           0);
             append(           0); append(raw(scale.y)); append(           0);
             append(           0); append(           0); append(raw(scale.z));
+            prelude_translation.offset = sink.count();
+            prelude_translation.count = 3;
             append(  raw(pos.x)); append(  raw(pos.y)); append(  raw(pos.z));
 
             // param for nop
@@ -233,29 +771,54 @@ namespace roads {
         }
 
     public:
-        disp_writer(display_list& lst, vector3f32 const& translation, vector3f32 const& scale)
-            : pipe(), buffer_start(lst.data()), buffer_pos(lst.data()), buffer_end(lst.data() + lst.size()),
-              pipe_index(0), buffer_full(false)
+        basic_disp_writer(display_list& lst, vector3f32 const& translation, vector3f32 const& scale)
+            : pipe(), sink(lst.data(), lst.data() + lst.size()),
+              pipe_index(0), buffer_full(false), primitive(no_primitive), batching(true),
+              shadow(), caching(true), compacting(true), strips(0), requested(), transaction_depth(0),
+              next_patch(0), prelude_translation()
         {
-            assert(buffer_end - buffer_start >= min_buffer_length);
+            assert(lst.size() >= min_buffer_length);
             push_prelude(translation, scale);
         }
 
-        disp_writer(iterator buffer_start, iterator buffer_end, vector3f32 const& translation, vector3f32 const& scale)
-            : pipe(), buffer_start(buffer_start), buffer_pos(buffer_start), buffer_end(buffer_end),
-              pipe_index(0), buffer_full(false)
+        basic_disp_writer(iterator buffer_start, iterator buffer_end, vector3f32 const& translation, vector3f32 const& scale)
+            : pipe(), sink(buffer_start, buffer_end),
+              pipe_index(0), buffer_full(false), primitive(no_primitive), batching(true),
+              shadow(), caching(true), compacting(true), strips(0), requested(), transaction_depth(0),
+              next_patch(0), prelude_translation()
         {
             assert(buffer_end - buffer_start >= min_buffer_length);
             push_prelude(translation, scale);
         }
 
-        disp_writer& finish() {
+        // For sinks that don't run out of room.
+        basic_disp_writer(Sink const& sink, vector3f32 const& translation, vector3f32 const& scale)
+            : pipe(), sink(sink),
+              pipe_index(0), buffer_full(false), primitive(no_primitive), batching(true),
+              shadow(), caching(true), compacting(true), strips(0), requested(), transaction_depth(0),
+              next_patch(0), prelude_translation()
+        {
+            push_prelude(translation, scale);
+        }
+
+        basic_disp_writer& finish() {
+            write_strips();
             push(gfx_matrix_pop, 1);
             flush_pipe();
+            // Whatever gets drawn after this list must begin its own
+            // primitives, and may have changed any state we know of.
+            primitive = no_primitive;
+            shadow.valid = 0;
+            counter.begin(geometry_counter::no_primitive);
             return *this;
         }
     };
 
+    typedef basic_disp_writer<buffer_sink> disp_writer;
+    typedef basic_disp_writer<fifo_sink> fifo_disp_writer;
+    typedef basic_disp_writer<counting_sink> counting_disp_writer;
+    typedef basic_disp_writer<null_sink> null_disp_writer;
+
     struct writer_end_t {};
     constexpr writer_end_t end {};
     struct writer_nop_t {};
@@ -290,7 +853,22 @@ namespace roads {
         int16_t specular, emission;
         bool enable_shininess_table;
     };
+    struct color {
+        rgb value;
+    };
+    // Makes the next normal, material or color patchable; see
+    // basic_disp_writer::patch_next.
+    struct patchable {
+        explicit patchable(patch_slot& slot) : slot(slot) {}
+        patch_slot& slot;
+    };
 
+    // arc and quad_strip keep pointers into their initializer lists, and
+    // are only meant to be written out in the expression that builds them.
+#if defined(__GNUC__) && __GNUC__ >= 9
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winit-list-lifetime"
+#endif
     struct arc_piece {
         uint32_t normal;
         vector3f16 vertex0, vertex1;
@@ -302,6 +880,9 @@ namespace roads {
         arc(std::initializer_list<arc_piece> pieces)
             : piece(&*pieces.begin()), end(piece + pieces.size())
         {}
+        arc(arc_piece const* first, arc_piece const* last)
+            : piece(first), end(last)
+        {}
     };
 
     struct quad_strip {
@@ -310,19 +891,35 @@ namespace roads {
             : data_start(&*verts.begin()), data_end(data_start + verts.size()) {
         }
     };
+#if defined(__GNUC__) && __GNUC__ >= 9
+#pragma GCC diagnostic pop
+#endif
+
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, normal const& n) {
+        return writer.set_state(gfx_normal, n.packed);
+    }
+
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, color c) {
+        return writer.set_state(gfx_color, c.value);
+    }
 
-    inline disp_writer& operator<<(disp_writer& writer, normal const& n) {
-        return writer.push(gfx_normal, n.packed);
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, patchable p) {
+        return writer.patch_next(p.slot);
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, vector3f16 vertex) {
-        return writer.push(gfx_vertex16, vertex_pack(vertex.x, vertex.y), vertex_pack(vertex.z, 0));
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, vector3f16 vertex) {
+        return writer.write_vertex(vertex);
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, arc a) {
-        auto saved = writer.save();
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, arc a) {
+        writer.begin_transaction();
 
-        writer.push(gfx_begin, gl_quad_strip);
+        writer.begin(gl_quad_strip);
 
         for(; a.piece != a.end; ++a.piece) {
             writer
@@ -331,94 +928,101 @@ namespace roads {
                 << a.piece->vertex1;
         }
 
-        if(!writer)
-            writer.reset(saved);
-        return writer;
+        return writer.end_transaction();
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, quad_strip qs) {
-        auto saved = writer.save();
-        writer.push(gfx_begin, gl_quad_strip);
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, quad_strip qs) {
+        writer.begin_transaction();
+        writer.begin(gl_quad_strip);
         for(; qs.data_start != qs.data_end; ++qs.data_start)
             writer << *qs.data_start;
-        if(!writer)
-            writer.reset(saved);
-        return writer;
+        return writer.end_transaction();
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, vertex const& v) {
-        auto saved = writer.save();
-        writer.push(gfx_normal, normal_pack(v.normal)) << v.position;
-        if(!writer)
-            writer.reset(saved);
-        return writer;
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, vertex const& v) {
+        writer.begin_transaction();
+        writer.set_state(gfx_normal, normal_pack(v.normal)) << v.position;
+        return writer.end_transaction();
     }
 
-    inline disp_writer& raw_vertex(disp_writer& writer, vertex const& v) {
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& raw_vertex(basic_disp_writer<Sink>& writer, vertex const& v) {
         // caller takes care of state
-        return writer.push(gfx_normal, normal_pack(v.normal)) << v.position;
+        return writer.set_state(gfx_normal, normal_pack(v.normal)) << v.position;
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, diffuse_ambient diff_amb) {
-        return writer.push(gfx_diffuse_ambient,
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, diffuse_ambient diff_amb) {
+        return writer.set_state(gfx_diffuse_ambient,
                              (uint32_t(diff_amb.diffuse) & 0xFFFF)
                            | (uint32_t(diff_amb.ambient) << 16)
                            | ((diff_amb.set_vertex_color ? 1 : 0) << 15) );
     }
-    inline disp_writer& operator<<(disp_writer& writer, specular_emission spec_emis) {
-        return writer.push(gfx_specular_emission,
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, specular_emission spec_emis) {
+        return writer.set_state(gfx_specular_emission,
                              (uint32_t(spec_emis.specular) & 0xFFFF)
                            | (uint32_t(spec_emis.emission) << 16)
                            | ((spec_emis.enable_shininess_table ? 1 : 0) << 15) );
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, nquad const& q) {
-        auto saved = writer.save();
-        writer.push(gfx_begin, gl_quads);
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, nquad const& q) {
+        writer.begin_transaction();
+        writer.begin(gl_quads);
         raw_vertex(writer, q.a);
         raw_vertex(writer, q.b);
         raw_vertex(writer, q.c);
         raw_vertex(writer, q.d);
-        if(!writer)
-            writer.reset(saved);
-        return writer;
+        return writer.end_transaction();
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, writer_nop_t) {
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, writer_nop_t) {
         return writer.push(gfx_nop, 0);
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, writer_end_t) {
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, writer_end_t) {
         return writer.finish();
     }
+
+    template <typename Sink, typename... Items>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, static_list<Items...> const&) {
+        typedef static_list<Items...> list;
+        return writer.splice(list::data, list::size, count_geometry(list::data, list::size));
+    }
     namespace detail {
         template <typename T> T fake();
     }
 
     // This utility makes passing modifier functions easier.
-    template <typename F>
+    template <typename Sink, typename F>
     inline
     typename std::enable_if<std::is_same<
-                    decltype(detail::fake<F>()(detail::fake<disp_writer&>())),
-                    disp_writer&>::value, disp_writer&>::type
-    operator<<(disp_writer& writer, F f) {
+                    decltype(detail::fake<F>()(detail::fake<basic_disp_writer<Sink>&>())),
+                    basic_disp_writer<Sink>&>::value, basic_disp_writer<Sink>&>::type
+    operator<<(basic_disp_writer<Sink>& writer, F f) {
         return f(writer);
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, quad const& q) {
-        auto saved = writer.save();
-        writer.push(gfx_begin, gl_quads) << q.a << q.b << q.c << q.d;
-        if(!writer)
-            writer.reset(saved);
-        return writer;
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, quad const& q) {
+        if(writer.get_strip_builder())
+            return writer.add_face(q.a, q.b, q.c, q.d);
+
+        writer.begin_transaction();
+        writer.begin(gl_quads) << q.a << q.b << q.c << q.d;
+        return writer.end_transaction();
     }
 
-    inline disp_writer& operator<<(disp_writer& writer, tri const& t) {
-        auto saved = writer.save();
-        writer.push(gfx_begin, gl_triangles) << t.a << t.b << t.c;
-        if(!writer)
-            writer.reset(saved);
-        return writer;
+    template <typename Sink>
+    inline basic_disp_writer<Sink>& operator<<(basic_disp_writer<Sink>& writer, tri const& t) {
+        writer.begin_transaction();
+        writer.begin(gl_triangles) << t.a << t.b << t.c;
+        return writer.end_transaction();
     }
 }
 
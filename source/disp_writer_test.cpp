@@ -6,6 +6,9 @@
 
 #include "unit_test.h"
 #include "disp_writer.h"
+#include "chunk_arena.h"
+#include "command_stream.h"
+#include "command_slab.h"
 #include "utility.h"
 #include <nds.h>
 
@@ -53,6 +56,32 @@ uint32_t const disp_lst[] = {
     1, 0, 0, 0
 };
 
+// Two quads written back to back share one begin.
+uint32_t const batch_lst[] = {
+    FIFO_COMMAND_PACK(FIFO_MATRIX_PUSH, FIFO_MATRIX_MULT4x3, FIFO_NOP, FIFO_NOP),
+    1 << 12, 0,       0,
+    0,       1 << 12, 0,
+    0,       0,       1 << 12,
+    0,       0,       (1 << 12) * -5,
+    0, // nop
+    0,
+    FIFO_COMMAND_PACK(FIFO_BEGIN, FIFO_VERTEX16, FIFO_VERTEX16, FIFO_VERTEX16),
+    GL_QUAD,
+    VERTEX_PACK(inttov16(-1),inttov16(1)), VERTEX_PACK(0,0),
+    VERTEX_PACK(inttov16(-1),inttov16(-1)), VERTEX_PACK(0,0),
+    VERTEX_PACK(inttov16(1),inttov16(-1)), VERTEX_PACK(0,0),
+
+    FIFO_COMMAND_PACK(FIFO_VERTEX16, FIFO_VERTEX16, FIFO_VERTEX16, FIFO_VERTEX16),
+    VERTEX_PACK(inttov16(1),inttov16(1)), VERTEX_PACK(0,0),
+    VERTEX_PACK(inttov16(-1),inttov16(1)), VERTEX_PACK(0,0),
+    VERTEX_PACK(inttov16(-1),inttov16(-1)), VERTEX_PACK(0,0),
+    VERTEX_PACK(inttov16(1),inttov16(-1)), VERTEX_PACK(0,0),
+
+    FIFO_COMMAND_PACK(FIFO_VERTEX16, FIFO_MATRIX_POP, FIFO_NOP, FIFO_NOP),
+    VERTEX_PACK(inttov16(1),inttov16(1)), VERTEX_PACK(0,0),
+    1, 0, 0
+};
+
 }
 
 namespace roads {
@@ -61,6 +90,8 @@ namespace roads {
         {
             uint32_t buf[1024];
             disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            // disp_lst spells out every vertex with FIFO_VERTEX16
+            writer.set_compact_vertices(false);
             UASSERT_EQUAL(writer.write_count(), 15);
             UASSERT_EQUAL(writer.get_pipe_index(), 0);
             UASSERT(bool(writer), "Writer not OK after writing prelude");
@@ -80,7 +111,604 @@ namespace roads {
             UASSERT_EQUAL(writer.write_count(), countof(disp_lst));
 
             for(size_t i = 0; i < countof(disp_lst); ++i) {
-                UASSERT(buf[i] == disp_lst[i], "[%d] %X != %X", i, buf[i], disp_lst[i]);
+                UASSERT(buf[i] == disp_lst[i], "[%d] %X != %X", int(i), buf[i], disp_lst[i]);
+            }
+        });
+
+        UNIT_TEST(batch_quads,
+        {
+            uint32_t buf[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            writer.set_compact_vertices(false);
+            writer
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << end;
+
+            UASSERT_EQUAL(writer.write_count(), countof(batch_lst));
+
+            for(size_t i = 0; i < countof(batch_lst); ++i) {
+                UASSERT(buf[i] == batch_lst[i], "[%d] %X != %X", int(i), buf[i], batch_lst[i]);
+            }
+        });
+
+        UNIT_TEST(batch_reset,
+        {
+            // A quad that gets rolled back must not leave the writer thinking
+            // that a begin has already been written.
+            uint32_t buf[1024], expected[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            auto saved = writer.save();
+            writer << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } };
+            writer.reset(saved);
+            writer
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << end;
+
+            disp_writer reference(expected, expected + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            reference
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << end;
+
+            UASSERT_EQUAL(writer.write_count(), reference.write_count());
+
+            for(size_t i = 0; i < reference.write_count(); ++i) {
+                UASSERT(buf[i] == expected[i], "[%d] %X != %X", int(i), buf[i], expected[i]);
+            }
+        });
+
+        UNIT_TEST(state_cache_elides,
+        {
+            uint32_t buf[1024], expected[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            for(int i = 0; i < 2; ++i) {
+                writer
+                    << diffuse_ambient { make_rgb(24, 24, 24), make_rgb(3, 3, 3), false }
+                    << normal { { 0, 0, -1 } }
+                    << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } };
+            }
+            writer << end;
+
+            disp_writer reference(expected, expected + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            reference.set_state_cache(false);
+            reference
+                << diffuse_ambient { make_rgb(24, 24, 24), make_rgb(3, 3, 3), false }
+                << normal { { 0, 0, -1 } }
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << end;
+
+            UASSERT_EQUAL(writer.write_count(), reference.write_count());
+
+            for(size_t i = 0; i < reference.write_count(); ++i) {
+                UASSERT(buf[i] == expected[i], "[%d] %X != %X", int(i), buf[i], expected[i]);
+            }
+        });
+
+        UNIT_TEST(state_cache_invalidation,
+        {
+            // The same normal has to be sent again after the material changes
+            // (the vertex color is lit when the normal is sent) and after the
+            // normal that was sent last has been rolled back.
+            uint32_t buf[1024], expected[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            writer
+                << normal { { 0, 0, -1 } }
+                << specular_emission { make_rgb(0, 0, 0), make_rgb(4, 4, 4), false }
+                << normal { { 0, 0, -1 } };
+            auto saved = writer.save();
+            writer << normal { { 0, 1, 0 } };
+            writer.reset(saved);
+            writer
+                << normal { { 0, 1, 0 } }
+                << color { make_rgb(31, 0, 0) }
+                << normal { { 0, 1, 0 } }
+                << end;
+
+            disp_writer reference(expected, expected + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            reference.set_state_cache(false);
+            reference
+                << normal { { 0, 0, -1 } }
+                << specular_emission { make_rgb(0, 0, 0), make_rgb(4, 4, 4), false }
+                << normal { { 0, 0, -1 } }
+                << normal { { 0, 1, 0 } }
+                << color { make_rgb(31, 0, 0) }
+                << normal { { 0, 1, 0 } }
+                << end;
+
+            UASSERT_EQUAL(writer.write_count(), reference.write_count());
+
+            for(size_t i = 0; i < reference.write_count(); ++i) {
+                UASSERT(buf[i] == expected[i], "[%d] %X != %X", int(i), buf[i], expected[i]);
+            }
+        });
+
+        UNIT_TEST(compact_vertices,
+        {
+            uint32_t buf[1024], expected[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            writer
+                << vector3f16 { 0, 0, 0 }
+                << vector3f16 { 1, 0, 0 }
+                << vector3f16 { 1, 0.5, 1 }
+                << vector3f16 { f16(4097, raw_tag), f16(2050, raw_tag), f16(4093, raw_tag) };
+            auto saved = writer.save();
+            writer << vector3f16 { 1, 1, 1 };
+            writer.reset(saved);
+            writer
+                << vector3f16 { f16(-3, raw_tag), f16(5, raw_tag), f16(7, raw_tag) }
+                << vector3f16 { 2, -1, 0.25 }
+                << end;
+
+            disp_writer reference(expected, expected + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            reference
+                .push(gfx_vertex10, 0)
+                .push(gfx_vertex_xy, VERTEX_PACK(inttov16(1), 0))
+                .push(gfx_vertex_yz, VERTEX_PACK(2048, inttov16(1)))
+                .push(gfx_vertex_diff, (1 & 0x3FF) | ((2 & 0x3FF) << 10) | ((-3 & 0x3FF) << 20))
+                .push(gfx_vertex16, VERTEX_PACK(-3, 5), VERTEX_PACK(7, 0))
+                .push(gfx_vertex10, (128 & 0x3FF) | ((-64 & 0x3FF) << 10) | ((16 & 0x3FF) << 20))
+                << end;
+
+            UASSERT_EQUAL(writer.write_count(), reference.write_count());
+
+            for(size_t i = 0; i < reference.write_count(); ++i) {
+                UASSERT(buf[i] == expected[i], "[%d] %X != %X", int(i), buf[i], expected[i]);
+            }
+        });
+
+        struct static_body : static_list<
+            static_diffuse_ambient<make_rgb(24, 24, 24), make_rgb(3, 3, 3), true>,
+            static_cmd<gfx_begin, gl_quads>,
+            static_vertex<-4096, 4096, 0>,
+            static_cmd<gfx_matrix_push>,
+            static_vertex<-4096, -4096, 0>,
+            static_seq<
+                static_vertex<4096, -4096, 0>,
+                static_vertex<4096, 4096, 0> >,
+            static_cmd<gfx_matrix_pop, 1>
+        > {};
+
+        UNIT_TEST(static_list_layout,
+        {
+            // The same commands through the writer, with nothing elided or
+            // compacted, must come out word for word the same.
+            uint32_t buf[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            writer.set_batching(false);
+            writer.set_state_cache(false);
+            writer.set_compact_vertices(false);
+            size_t const start = writer.write_count();
+            writer
+                << diffuse_ambient { make_rgb(24, 24, 24), make_rgb(3, 3, 3), true };
+            writer.begin(gl_quads);
+            writer
+                << vector3f16 { -1, 1, 0 };
+            writer.push(gfx_matrix_push);
+            writer
+                << vector3f16 { -1, -1, 0 }
+                << vector3f16 { 1, -1, 0 }
+                << vector3f16 { 1, 1, 0 };
+            writer.push(gfx_matrix_pop, 1);
+            writer.flush_pipe();
+
+            UASSERT_EQUAL(writer.get_pipe_index(), 0);
+            UASSERT_EQUAL(writer.write_count() - start, static_body::size);
+
+            for(size_t i = 0; i < static_body::size; ++i) {
+                UASSERT(buf[start + i] == static_body::data[i], "[%d] %X != %X", int(i), buf[start + i], static_body::data[i]);
+            }
+        });
+
+        UNIT_TEST(static_list_splice,
+        {
+            uint32_t buf[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            writer << normal { { 0, 0, -1 } };
+            size_t const start = writer.write_count();
+            writer << static_body();
+            UASSERT(bool(writer), "Writer not OK after splicing");
+            UASSERT_EQUAL(writer.get_pipe_index(), 0);
+            // one header with the normal and three nops, then the list
+            UASSERT_EQUAL(writer.write_count() - start, 5 + static_body::size);
+
+            for(size_t i = 0; i < static_body::size; ++i) {
+                UASSERT(buf[start + 5 + i] == static_body::data[i], "[%d] %X != %X", int(i), buf[start + 5 + i], static_body::data[i]);
+            }
+
+            // the spliced words may have changed the normal
+            writer << normal { { 0, 0, -1 } };
+            UASSERT_EQUAL(writer.get_pipe_index(), 1);
+
+            uint32_t small[16];
+            disp_writer full(small, small + 16, { 0, 0, -5 }, { 1, 1, 1 });
+            full << static_body();
+            UASSERT(!full, "Splicing into a full buffer should fail");
+        });
+
+        UNIT_TEST(counting_sink_size,
+        {
+            uint32_t buf[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            counting_disp_writer counter(counting_sink(), { 0, 0, -5 }, { 1, 1, 1 });
+            null_disp_writer null(null_sink(), { 0, 0, -5 }, { 1, 1, 1 });
+            for(int i = 0; i < 20; ++i) {
+                vector3f16 const v { i, 0, 0 };
+                writer << normal { { 0, 0, i & 1 ? 1 : -1 } } << quad { v, v, v, v };
+                counter << normal { { 0, 0, i & 1 ? 1 : -1 } } << quad { v, v, v, v };
+                null << normal { { 0, 0, i & 1 ? 1 : -1 } } << quad { v, v, v, v };
+            }
+            auto saved = counter.save();
+            counter << quad { { 1, 1, 1 }, { 1, 1, 1 }, { 1, 1, 1 }, { 1, 1, 1 } };
+            counter.reset(saved);
+            writer << end;
+            counter << end;
+            null << end;
+
+            UASSERT(bool(writer), "Writer not OK");
+            UASSERT(bool(counter) && bool(null), "Unbounded sinks should never fill up");
+            UASSERT_EQUAL(counter.write_count(), writer.write_count());
+            UASSERT_EQUAL(null.write_count(), 0);
+        });
+
+        UNIT_TEST(chunk_sink_matches_buffer,
+        {
+            // Enough quads to need several chunks, with one of them rolled
+            // back across a chunk boundary.
+            static uint32_t buf[4096];
+            disp_writer writer(buf, buf + 4096, { 0, 0, -5 }, { 1, 1, 1 });
+            chunk_arena arena;
+            chunk_disp_writer chunked(chunk_sink(arena), { 0, 0, -5 }, { 1, 1, 1 });
+            for(int i = 0; i < 300; ++i) {
+                vector3f16 const v { i, i, 0 };
+                writer << normal { { 0, 0, i & 1 ? 1 : -1 } } << quad { v, v, v, v };
+                chunked << normal { { 0, 0, i & 1 ? 1 : -1 } } << quad { v, v, v, v };
+                if(i == 100) {
+                    auto saved = chunked.save();
+                    for(int j = 0; j < 60; ++j)
+                        chunked << normal { { 0, 1, 0 } } << quad { v, v, v, v };
+                    chunked.reset(saved);
+                }
+            }
+            writer << end;
+            chunked << end;
+
+            UASSERT(bool(writer) && bool(chunked), "Writer not OK");
+            UASSERT(arena.chunk_count() > 1, "Expected more than one chunk");
+            UASSERT_EQUAL(chunked.write_count(), writer.write_count());
+            UASSERT_EQUAL(arena.size(), writer.write_count());
+
+            std::vector<uint32_t> copied(arena.size());
+            arena.copy_to(&copied[0]);
+            for(size_t i = 0; i < copied.size(); ++i) {
+                UASSERT(copied[i] == buf[i], "[%d] %X != %X", int(i), copied[i], buf[i]);
+            }
+        });
+
+        UNIT_TEST(geometry_counts_written,
+        {
+            uint32_t buf[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            for(int i = 0; i < 3; ++i) {
+                vector3f16 const v { i, 0, 0 };
+                writer << normal { { 0, 0, 1 } } << quad { v, v, v, v };
+            }
+            writer << tri { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 } };
+            writer << quad_strip { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 2, 0, 0 }, { 2, 1, 0 } };
+
+            geometry_counts const g = writer.geometry();
+            UASSERT_EQUAL(g.quads, 5);
+            UASSERT_EQUAL(g.triangles, 1);
+            UASSERT_EQUAL(g.strip_vertices, 6);
+            UASSERT_EQUAL(g.vertices, 21);
+            UASSERT_EQUAL(g.polygons(), 6);
+
+            // rolled back along with the commands
+            auto saved = writer.save();
+            writer << quad { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 } };
+            UASSERT_EQUAL(writer.geometry().quads, 6);
+            writer.reset(saved);
+            UASSERT_EQUAL(writer.geometry().quads, 5);
+
+            // spliced lists are counted too
+            writer << static_body() << end;
+            UASSERT_EQUAL(writer.geometry().quads, 6);
+            UASSERT_EQUAL(writer.geometry().vertices, 25);
+        });
+
+        UNIT_TEST(frame_budget_policies,
+        {
+            geometry_counts row = geometry_counts();
+            row.quads = 40;
+            row.vertices = 160;
+
+            frame_budget report(frame_budget::report_overflow, 100);
+            frame_budget drop(frame_budget::drop_farthest, 100);
+            for(int i = 0; i < 3; ++i) {
+                UASSERT(report.charge(row), "report_overflow must draw everything");
+                bool const drawn = drop.charge(row);
+                UASSERT_EQUAL(drawn, i < 2);
+            }
+            UASSERT(report.overflowed && drop.overflowed, "Overflow not noticed");
+            UASSERT_EQUAL(report.used.polygons(), 120);
+            UASSERT_EQUAL(drop.used.polygons(), 80);
+
+            drop.begin_frame();
+            UASSERT(!drop.overflowed, "Overflow not cleared");
+            UASSERT_EQUAL(drop.used.polygons(), 0);
+
+            // the vertex limit counts as well
+            frame_budget vertices(frame_budget::drop_farthest, 1000, 200);
+            UASSERT(vertices.charge(row), "Row should fit");
+            UASSERT(!vertices.charge(row), "Row should not fit");
+        });
+
+        UNIT_TEST(strip_builder_joins_quads,
+        {
+            uint32_t buf[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            strip_builder strips;
+            writer.set_strip_builder(&strips);
+
+            // three quads side by side on the xz plane, then one facing
+            // another way that shares an edge with the last of them
+            writer << diffuse_ambient { make_rgb(24, 24, 24), make_rgb(3, 3, 3), false };
+            writer << normal { { 0, 1, 0 } };
+            for(int i = 0; i < 3; ++i) {
+                writer << quad { { i, 0, 0 }, { i + 1, 0, 0 }, { i + 1, 0, -1 }, { i, 0, -1 } };
+            }
+            auto saved = writer.save();
+            writer << quad { { 5, 0, 0 }, { 6, 0, 0 }, { 6, 0, -1 }, { 5, 0, -1 } };
+            UASSERT_EQUAL(strips.size(), 4);
+            writer.reset(saved);
+            UASSERT_EQUAL(strips.size(), 3);
+
+            writer << normal { { 0, 0, 1 } }
+                   << quad { { 3, 1, 0 }, { 3, 0, 0 }, { 3, 0, -1 }, { 3, 1, -1 } };
+            UASSERT_EQUAL(writer.geometry().polygons(), 0);
+            writer << end;
+
+            UASSERT(bool(writer), "Writer not OK");
+            UASSERT_EQUAL(strips.size(), 0);
+            geometry_counts const g = writer.geometry();
+            UASSERT_EQUAL(g.quads, 4);
+            UASSERT_EQUAL(g.strip_vertices, 8);
+            UASSERT_EQUAL(g.vertices, 12);
+
+            std::vector<decoded_command> commands;
+            UASSERT(decode_commands(buf, writer.write_count(), commands), "Decode failed");
+            size_t begins = 0, normals = 0;
+            for(size_t i = 0; i < commands.size(); ++i) {
+                if(commands[i].id == id(gfx_begin)) {
+                    // the single quad comes first
+                    UASSERT_EQUAL(commands[i].params[0], begins == 0 ? gl_quads : gl_quad_strip);
+                    ++begins;
+                }
+                if(commands[i].id == id(gfx_normal))
+                    ++normals;
+            }
+            UASSERT_EQUAL(begins, 2);
+            UASSERT_EQUAL(normals, 2);
+        });
+
+        UNIT_TEST(optimize_drops_padding,
+        {
+            std::vector<uint32_t> words {
+                fifo_pack(gfx_color, gfx_nop, gfx_nop, gfx_nop), 0x7fff, 0, 0, 0,
+                fifo_pack(gfx_normal, gfx_nop, gfx_nop, gfx_nop), 0x1234, 0, 0, 0,
+            };
+            size_t const saved = optimize(words);
+            UASSERT_EQUAL(saved, 5);
+            UASSERT_EQUAL(words.size(), 5);
+            UASSERT(words[0] == fifo_pack(gfx_color, gfx_normal, gfx_nop, gfx_nop), "Bad header %X", words[0]);
+            UASSERT(words[1] == 0x7fff && words[2] == 0x1234, "Parameters out of order");
+            UASSERT(words[3] == 0 && words[4] == 0, "Nops not padded with zero");
+
+            // nothing left to take out
+            size_t const saved_again = optimize(words);
+            UASSERT_EQUAL(saved_again, 0);
+            UASSERT_EQUAL(words.size(), 5);
+        });
+
+        UNIT_TEST(optimize_slot3_reorder,
+        {
+            // gfx_end would land in the top slot; gfx_diffuse_ambient can
+            // go before it instead.
+            std::vector<uint32_t> words {
+                fifo_pack(gfx_color, gfx_normal, gfx_normal, gfx_nop), 1, 2, 3, 0,
+                fifo_pack(gfx_end, gfx_diffuse_ambient, gfx_color, gfx_normal), 4, 5, 6,
+                fifo_pack(gfx_normal, gfx_nop, gfx_nop, gfx_nop), 7, 0, 0, 0,
+            };
+            size_t const saved = optimize(words);
+            UASSERT_EQUAL(saved, 5);
+            UASSERT(words[0] == fifo_pack(gfx_color, gfx_normal, gfx_normal, gfx_diffuse_ambient), "Bad header %X", words[0]);
+            UASSERT(words[4] == 4, "Parameter not moved with its command");
+            UASSERT(words[5] == fifo_pack(gfx_end, gfx_color, gfx_normal, gfx_normal), "Bad header %X", words[5]);
+
+            // a push can't be moved past a translation
+            std::vector<uint32_t> fixed {
+                fifo_pack(gfx_color, gfx_normal, gfx_normal, gfx_nop), 1, 2, 3, 0,
+                fifo_pack(gfx_matrix_push, gfx_matrix_trans, gfx_nop, gfx_nop), 4, 5, 6, 0, 0,
+            };
+            std::vector<uint32_t> const before = fixed;
+            optimize(fixed);
+            UASSERT(fixed[0] == fifo_pack(gfx_color, gfx_normal, gfx_normal, gfx_nop), "Bad header %X", fixed[0]);
+
+            std::vector<decoded_command> a, b;
+            UASSERT(decode_commands(&before[0], before.size(), a), "Decode failed");
+            UASSERT(decode_commands(&fixed[0], fixed.size(), b), "Decode failed");
+            UASSERT_EQUAL(a.size(), b.size());
+            for(size_t i = 0; i < a.size(); ++i) {
+                UASSERT_EQUAL(a[i].id, b[i].id);
+            }
+        });
+
+        UNIT_TEST(optimize_written_list,
+        {
+            // The writer's output must decode to the same commands with the
+            // same parameters after repacking.
+            uint32_t buf[1024];
+            disp_writer writer(buf, buf + 1024, { 0, 0, -5 }, { 1, 1, 1 });
+            for(int i = 0; i < 20; ++i) {
+                vector3f16 const v { i, i, 0 };
+                writer << normal { { 0, 0, i & 1 ? 1 : -1 } } << quad { v, v, v, v };
+            }
+            writer << end;
+            UASSERT(bool(writer), "Writer not OK");
+
+            std::vector<uint32_t> words(buf, buf + writer.write_count());
+            optimize(words);
+            UASSERT(words.size() <= writer.write_count(), "List grew");
+
+            std::vector<decoded_command> a, b;
+            UASSERT(decode_commands(buf, writer.write_count(), a), "Decode failed");
+            UASSERT(decode_commands(&words[0], words.size(), b), "Decode failed");
+            UASSERT_EQUAL(a.size(), b.size());
+            for(size_t i = 0; i < a.size(); ++i) {
+                UASSERT_EQUAL(a[i].id, b[i].id);
+                for(size_t j = 0; j < a[i].pcount; ++j)
+                    UASSERT_EQUAL(a[i].params[j], b[i].params[j]);
+            }
+        });
+
+        UNIT_TEST(patch_slots,
+        {
+            // A patchable color is written even though it's the same as the
+            // last one, and the state cache forgets it afterwards.
+            rgb const red = make_rgb(31, 0, 0), blue = make_rgb(0, 0, 31);
+            display_list lst;
+            lst.resize(1024);
+            disp_writer writer(lst, { 1, 2, 3 }, { 1, 1, 1 });
+            patch_slot const where = writer.translation_slot();
+            patch_slot tint;
+            writer
+                << color { red }
+                << patchable(tint) << color { red }
+                << color { red }
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << end;
+            lst.resize(writer.write_count());
+
+            uint32_t expected[1024];
+            disp_writer reference(expected, expected + 1024, { 1, 2, 3 }, { 1, 1, 1 });
+            reference.set_state_cache(false);
+            reference
+                << color { red } << color { red } << color { red }
+                << quad { { -1, 1, 0 }, { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 } }
+                << end;
+            UASSERT_EQUAL(lst.size(), reference.write_count());
+            for(size_t i = 0; i < lst.size(); ++i)
+                UASSERT(lst.data()[i] == expected[i], "[%d] %X != %X", int(i), lst.data()[i], expected[i]);
+
+            UASSERT(bool(where) && bool(tint), "Slot not recorded");
+            UASSERT_EQUAL(where.count, 3);
+            UASSERT_EQUAL(lst.data()[where.offset + 2], uint32_t(raw(f32(3))));
+            UASSERT_EQUAL(tint.count, 1);
+            UASSERT_EQUAL(lst.data()[tint.offset], uint32_t(red));
+
+            lst.patch(tint, blue);
+            lst.patch(where, vector3f32(4, 5, 6));
+            UASSERT_EQUAL(lst.data()[tint.offset], uint32_t(blue));
+            UASSERT_EQUAL(lst.data()[where.offset], uint32_t(raw(f32(4))));
+            UASSERT_EQUAL(lst.data()[where.offset + 1], uint32_t(raw(f32(5))));
+            UASSERT_EQUAL(lst.data()[where.offset + 2], uint32_t(raw(f32(6))));
+            // the words around them are left alone
+            UASSERT_EQUAL(lst.data()[tint.offset - 1], expected[tint.offset - 1]);
+            UASSERT_EQUAL(lst.data()[tint.offset + 1], expected[tint.offset + 1]);
+        });
+
+        UNIT_TEST(command_slab_ring,
+        {
+            command_slab slab;
+            size_t const third = command_slab::initial_words / 3;
+            {
+                slab_list a = slab.allocate(third - 1);
+                slab_list b = slab.allocate(third - 1);
+                UASSERT(b.data() == a.data() + third, "Not packed");
+                slab_list c = slab.allocate(third - 1);
+                UASSERT_EQUAL(slab.stats().rings, 1);
+                UASSERT_EQUAL(slab.stats().live_words, 3 * (third - 1));
+
+                // b is only given back once a is
+                b.clear();
+                slab_list d = slab.allocate(third);
+                UASSERT_EQUAL(slab.stats().rings, 2);
+                d.clear();
+                a.clear();
+                c.clear();
+                UASSERT_EQUAL(slab.stats().live_words, 0);
+
+                // in the new ring, the oldest lists make room at the start
+                size_t const half = command_slab::initial_words - 1;
+                slab_list e = slab.allocate(half);
+                slab_list f = slab.allocate(half);
+                UASSERT_EQUAL(slab.stats().rings, 1);
+                uint32_t const* const start = e.data();
+                e.clear();
+                slab_list g = slab.allocate(half / 2);
+                UASSERT(g.data() == start, "Not wrapped");
+                slab_list h = slab.allocate(half / 2);
+                UASSERT_EQUAL(slab.stats().rings, 1);
+                UASSERT_EQUAL(slab.stats().resident_words, 2 * command_slab::initial_words);
+
+                slab_list big = slab.allocate(2 * command_slab::initial_words);
+                UASSERT_EQUAL(slab.stats().rings, 2);
+                UASSERT_EQUAL(slab.stats().peak_resident_words, 6 * command_slab::initial_words);
+            }
+            UASSERT_EQUAL(slab.stats().live_words, 0);
+            UASSERT_EQUAL(slab.stats().rings, 1);
+            slab.trim();
+            UASSERT_EQUAL(slab.stats().rings, 0);
+            UASSERT_EQUAL(slab.stats().resident_words, 0);
+        });
+
+        UNIT_TEST(transaction_rollback,
+        {
+            // Every quad has its own normal, which a rolled back quad must
+            // not leave the writer thinking the geometry engine already has.
+            auto make = [](int i) {
+                vector3f16 const n = i % 2 ? vector3f16 { 1, 0, 0 } : vector3f16 { 0, 1, 0 };
+                return nquad { { { i, 0, 0 }, n }, { { i + 1, 0, 0 }, n },
+                               { { i + 1, 1, 0 }, n }, { { i, 1, 0 }, n } };
+            };
+
+            // every size runs out of room at a different point of a quad
+            for(size_t size = disp_writer::min_buffer_length + 4; size < 64; ++size) {
+                uint32_t first[64], second[256];
+                disp_writer writer(first, first + size, { 0, 0, -5 }, { 1, 1, 1 });
+                int written = 0;
+                size_t count = 0;
+                geometry_counts before = geometry_counts();
+                for(;; ++written) {
+                    count = writer.write_count();
+                    before = writer.geometry();
+                    if(!(writer << make(written)))
+                        break;
+                }
+                UASSERT_EQUAL(writer.write_count(), count);
+                UASSERT_EQUAL(writer.geometry().quads, before.quads);
+                UASSERT_EQUAL(writer.geometry().vertices, before.vertices);
+
+                // written again into a new buffer, as after growing the list
+                writer.reseat_buffer(second, second + countof(second));
+                writer << make(written) << end;
+                UASSERT(bool(writer), "Writer not OK");
+
+                std::vector<uint32_t> words(first, first + count);
+                words.insert(words.end(), second, second + writer.write_count());
+                geometry_counts const g = count_geometry(words.data(), words.size());
+                UASSERT_EQUAL(g.quads, size_t(written + 1));
+                UASSERT_EQUAL(writer.geometry().quads, g.quads);
+                UASSERT_EQUAL(writer.geometry().vertices, g.vertices);
+
+                std::vector<decoded_command> commands;
+                UASSERT(decode_commands(second, writer.write_count(), commands), "Decode failed");
+                uint32_t normal = 0;
+                for(size_t i = 0; i < commands.size(); ++i) {
+                    if(commands[i].id == id(gfx_normal))
+                        normal = commands[i].params[0];
+                }
+                UASSERT(normal == normal_pack(make(written).a.normal), "Normal of the retried quad not written");
             }
         });
 
@@ -92,6 +720,24 @@ namespace roads {
     void create_tests<disp_writer>(unit_test_suite& suite)
     {
         suite.add_test(make_auto(new write_quad));
+        suite.add_test(make_auto(new batch_quads));
+        suite.add_test(make_auto(new batch_reset));
+        suite.add_test(make_auto(new state_cache_elides));
+        suite.add_test(make_auto(new state_cache_invalidation));
+        suite.add_test(make_auto(new compact_vertices));
+        suite.add_test(make_auto(new static_list_layout));
+        suite.add_test(make_auto(new static_list_splice));
+        suite.add_test(make_auto(new counting_sink_size));
+        suite.add_test(make_auto(new chunk_sink_matches_buffer));
+        suite.add_test(make_auto(new geometry_counts_written));
+        suite.add_test(make_auto(new frame_budget_policies));
+        suite.add_test(make_auto(new strip_builder_joins_quads));
+        suite.add_test(make_auto(new optimize_drops_padding));
+        suite.add_test(make_auto(new optimize_slot3_reorder));
+        suite.add_test(make_auto(new optimize_written_list));
+        suite.add_test(make_auto(new patch_slots));
+        suite.add_test(make_auto(new command_slab_ring));
+        suite.add_test(make_auto(new transaction_rollback));
     }
 }
 
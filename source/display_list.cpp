@@ -9,6 +9,8 @@
 #include "glcore.h"
 #include "geometry.h"
 #include "dmacore.h"
+#include "dma_queue.h"
+#include "static_list.h"
 
 namespace roads
 {
@@ -17,12 +19,31 @@ namespace roads
 		if(cmdlist.empty())
 			return;
 
-		if(dirty)
-		{
-			DC_FlushRange(&cmdlist[0], cmdlist.size() * 4);
-			dirty = false;
-		}
-        
+		flush();
+		draw_words(&cmdlist[0], cmdlist.size());
+	}
+
+    void display_list::submit(dma_queue& queue) const
+    {
+        if(cmdlist.empty())
+            return;
+
+        flush();
+        queue.submit(&cmdlist[0], cmdlist.size());
+    }
+
+    void display_list::flush() const
+    {
+        if(dirty)
+            DC_FlushRange(&cmdlist[0], cmdlist.size() * 4);
+        else if(patched_begin != patched_end)
+            DC_FlushRange(&cmdlist[patched_begin], (patched_end - patched_begin) * 4);
+        dirty = false;
+        patched_begin = patched_end = 0;
+    }
+
+	void draw_words(uint32_t const* words, size_t count)
+	{
 		// don't start DMAing while anything else
 		// is being DMAed because FIFO DMA is touchy as hell
 		//    If anyone can explain this better that would be great. -- gabebear
@@ -34,9 +55,9 @@ namespace roads
 			 );
         
 		// send the packed list asynchronously via DMA to the FIFO
-		dma_reg<dma0_src>() = (uint32_t)&cmdlist[0];
+		dma_reg<dma0_src>() = bus_address(words);
 		dma_reg<dma0_dest>() = 0x4000400;
-		dma_reg<dma0_cr>() = dma_fifo | cmdlist.size();
+		dma_reg<dma0_cr>() = dma_fifo | count;
 		while(dma_reg<dma0_cr>() & dma_busy);
 	}
 }
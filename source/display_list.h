@@ -4,6 +4,7 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <cassert>
 #include <stdint.h>
 #include "vector.h"
 #include "cell.h"
@@ -16,6 +17,22 @@
 
 namespace roads
 {
+    struct dma_queue;
+
+    // Where the parameters of one command are in a written display_list,
+    // so that they can be changed without writing the list again. Recorded
+    // by disp_writer (see basic_disp_writer::patch_next).
+    struct patch_slot {
+        static size_t const none = size_t(-1);
+
+        patch_slot() : offset(none), count(0) {}
+
+        explicit operator bool() const { return offset != none; }
+
+        size_t offset;
+        size_t count;
+    };
+
     template <typename DispList>
     struct DispGetFn
     {
@@ -29,19 +46,25 @@ namespace roads
         template <typename> friend struct DispGetFn;
 
 		display_list()
-			: dirty(false) {}
+			: dirty(false), patched_begin(0), patched_end(0) {}
 		display_list(display_list&& rhs)
-            : cmdlist(std::move(rhs.cmdlist)), dirty(true) { rhs.dirty = false; }
+            : cmdlist(std::move(rhs.cmdlist)), dirty(true), patched_begin(0), patched_end(0) { rhs.dirty = false; }
         display_list& operator=(display_list&& rhs) {
             cmdlist = std::move(rhs.cmdlist);
             dirty = rhs.dirty;
+            patched_begin = rhs.patched_begin;
+            patched_end = rhs.patched_end;
             rhs.dirty = false;
+            rhs.patched_begin = rhs.patched_end = 0;
             return *this;
         }
 
         uint32_t* data() {
             return &cmdlist[0];
         }
+        uint32_t const* data() const {
+            return cmdlist.empty() ? 0 : &cmdlist[0];
+        }
 
         void resize(size_t count) {
             cmdlist.resize(count);
@@ -52,24 +75,57 @@ namespace roads
             return cmdlist.size();
         }
 
+        // Changes a word of the slot in place. Only the patched words are
+        // flushed the next time the list is drawn or submitted, and as with
+        // submit, a list the queue is still sending has to be left alone.
+        void patch(patch_slot const& slot, size_t index, uint32_t value) {
+            assert(slot && index < slot.count && slot.offset + slot.count <= cmdlist.size());
+            size_t const at = slot.offset + index;
+            cmdlist[at] = value;
+            if(patched_begin == patched_end) {
+                patched_begin = at;
+                patched_end = at + 1;
+            }
+            else {
+                patched_begin = std::min(patched_begin, at);
+                patched_end = std::max(patched_end, at + 1);
+            }
+        }
+        void patch(patch_slot const& slot, uint32_t value) {
+            patch(slot, 0, value);
+        }
+        // For a translation, such as basic_disp_writer::translation_slot.
+        void patch(patch_slot const& slot, vector3f32 const& v) {
+            assert(slot.count == 3);
+            patch(slot, 0, raw(v.x));
+            patch(slot, 1, raw(v.y));
+            patch(slot, 2, raw(v.z));
+        }
+
 		void draw() const;
+        // Like draw, but only queues the list (see dma_queue.h); it has to
+        // be left alone until the queue is done with it.
+        void submit(dma_queue& queue) const;
 		void swap(display_list& rhs)
 		{
             using std::swap;
             swap(cmdlist, rhs.cmdlist);
             swap(dirty, rhs.dirty);
+            swap(patched_begin, rhs.patched_begin);
+            swap(patched_end, rhs.patched_end);
 		}
 		void clear()
 		{
 			cmdlist.clear();
 			dirty = false;
+			patched_begin = patched_end = 0;
 		}
 
         std::vector<uint32_t> dbg_getlist() const
         {
             std::vector<uint32_t> ret(1, cmdlist.size());
             ret.insert(ret.end(), cmdlist.begin(), cmdlist.end());
-            return std::move(ret);
+            return ret;
         }
 
 	private:
@@ -83,9 +139,14 @@ namespace roads
 			cmdlist.push_back(packed_cmd);
 		}
     private:
+        // Flushes whatever has been written since the list was last drawn.
+        void flush() const;
 
 		std::vector<uint32_t> cmdlist;
 		mutable bool dirty;
+        // the words changed by patch since then, if the whole list isn't
+        // dirty anyway
+        mutable size_t patched_begin, patched_end;
 	};
 
     /*
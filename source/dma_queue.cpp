@@ -0,0 +1,153 @@
+#include "dma_queue.h"
+#include "dmacore.h"
+
+#ifdef ARM9
+#include <nds/interrupts.h>
+#endif
+
+namespace roads
+{
+    namespace
+    {
+        dma_queue* installed = 0;
+
+        // The IRQ handler changes the queue too, so the game loop keeps it
+        // out while it does.
+        int lock()
+        {
+#ifdef ARM9
+            return enterCriticalSection();
+#else
+            return host::enter_critical_section();
+#endif
+        }
+
+        void unlock(int old)
+        {
+#ifdef ARM9
+            leaveCriticalSection(old);
+#else
+            host::leave_critical_section(old);
+#endif
+        }
+    }
+
+    dma_queue::~dma_queue()
+    {
+        if(installed != this)
+            return;
+
+        wait_idle();
+#ifdef ARM9
+        irqDisable(IRQ_DMA0);
+        irqClear(IRQ_DMA0);
+#else
+        host::set_dma_irq_handler(0, 0);
+#endif
+        installed = 0;
+    }
+
+    void dma_queue::install()
+    {
+        installed = this;
+#ifdef ARM9
+        irqSet(IRQ_DMA0, &dma_queue::irq);
+        irqEnable(IRQ_DMA0);
+#else
+        host::set_dma_irq_handler(0, &dma_queue::irq);
+#endif
+    }
+
+    void dma_queue::submit(uint32_t const* words, size_t count)
+    {
+        if(count == 0)
+            return;
+
+        int old = lock();
+        while(tail - head >= capacity) {
+            // let the IRQ in to make room
+            unlock(old);
+            old = lock();
+        }
+
+        transfer const t = { words, count };
+        pending[tail % capacity] = t;
+        ++tail;
+        ++submitted;
+        if(!running || stalled)
+            next();
+        unlock(old);
+    }
+
+    bool dma_queue::reached(fence_t f) const
+    {
+        int const old = lock();
+        retry();
+        bool const ret = int32_t(completed - f) >= 0;
+        unlock(old);
+        return ret;
+    }
+
+    bool dma_queue::busy() const
+    {
+        int const old = lock();
+        retry();
+        bool const ret = running;
+        unlock(old);
+        return ret;
+    }
+
+    void dma_queue::wait_idle() const
+    {
+        while(busy());
+    }
+
+    // DMA0 has sent the whole list to the FIFO.
+    void dma_queue::irq()
+    {
+        ++installed->completed;
+        installed->next();
+    }
+
+    // Starts the oldest pending transfer, with the IRQ kept out, or leaves
+    // it stalled while another channel is busy.
+    void dma_queue::next()
+    {
+        if(head == tail) {
+            running = false;
+            stalled = false;
+            return;
+        }
+
+        running = true;
+        stalled = !channels_idle();
+        if(stalled)
+            return;
+
+        transfer const t = pending[head % capacity];
+        ++head;
+        start(t);
+    }
+
+    void dma_queue::retry() const
+    {
+        // the handler is kept out, so nothing else changes the queue
+        if(stalled)
+            const_cast<dma_queue*>(this)->next();
+    }
+
+    // the same precaution as in draw_words
+    bool dma_queue::channels_idle()
+    {
+        return !(dma_reg<dma1_cr>() & dma_busy)
+            && !(dma_reg<dma2_cr>() & dma_busy)
+            && !(dma_reg<dma3_cr>() & dma_busy);
+    }
+
+    void dma_queue::start(transfer const& t)
+    {
+        dma_reg<dma0_src>() = bus_address(t.words);
+        dma_reg<dma0_dest>() = 0x4000400;
+        dma_reg<dma0_cr>() = dma_fifo | dma_irq_req | t.count;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef ROADS_DMA_QUEUE_H
+#define ROADS_DMA_QUEUE_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace roads {
+    /*
+     * Sends lists to the geometry engine FIFO without waiting for them.
+     *
+     * draw_words waits for the DMA channels to go idle, starts DMA0 and then
+     * waits for it to finish, so the CPU sits idle for as long as it takes
+     * the geometry engine to eat the list. A dma_queue only remembers the
+     * list and returns; DMA0 is started on the first one, and every time it
+     * finishes the completion IRQ starts it on the next one:
+     *
+     *     queue.install();           // once, takes over the DMA0 IRQ
+     *
+     *     queue.wait_idle();         // before writing the FIFO directly
+     *     ...
+     *     row.data.submit(queue);
+     *     frame_end::submit(queue);
+     *     // physics and row generation run while the lists are sent
+     *
+     * The lists have to stay where they are, unchanged, until the queue is
+     * done with them. fence() names everything submitted so far and
+     * reached() tells whether all of it has been sent, which is how level
+     * knows when the rows it dropped can be written over.
+     *
+     * Nothing else may write to the FIFO while the queue is busy, neither the
+     * CPU nor another draw_words.
+     *
+     * Like draw_words, the queue only starts DMA0 while the other channels
+     * are idle. The IRQ handler doesn't wait for them, since a long copy on
+     * one of them would hold up every other interrupt. It leaves the
+     * transfer pending, and submit, busy, reached and wait_idle start it
+     * once the channels have gone idle.
+     */
+    struct dma_queue {
+        enum { capacity = 64 };
+
+        typedef uint32_t fence_t;
+
+        dma_queue() : head(0), tail(0), submitted(0), completed(0), running(false), stalled(false) {}
+        ~dma_queue();
+
+        // Routes the DMA0 completion IRQ to this queue. Only one queue can
+        // be installed at a time.
+        void install();
+
+        // Queues count words to be sent to the FIFO after everything
+        // submitted before them. Only waits if the queue is full.
+        void submit(uint32_t const* words, size_t count);
+
+        fence_t fence() const { return submitted; }
+        bool reached(fence_t f) const;
+
+        bool busy() const;
+        void wait_idle() const;
+
+    private:
+        struct transfer {
+            uint32_t const* words;
+            size_t count;
+        };
+
+        static void irq();
+        static bool channels_idle();
+        static void start(transfer const& t);
+        void next();
+        // Starts the transfer the IRQ handler left pending, if the other
+        // channels let it. Called with the IRQ kept out.
+        void retry() const;
+
+        transfer pending[capacity];
+        // Written by both the game loop and the IRQ handler.
+        size_t volatile head, tail;
+        fence_t volatile submitted, completed;
+        bool volatile running;
+        // running, but DMA0 not started because another channel was busy
+        bool volatile stalled;
+    };
+}
+
+#endif // ROADS_DMA_QUEUE_H
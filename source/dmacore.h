@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+#ifndef ARM9
+#include "roads_host.h"
+#endif
+
 namespace roads
 {
     enum { dma_address_base = 0x04000000 };
@@ -68,6 +72,7 @@ namespace roads
         dma_fifo           = dma_enable | dma_32_bit | dma_dst_fix | dma_start_fifo
     };
 
+#ifdef ARM9
     template <dma_offset_t Offset>
     uint32_t volatile& dma_reg()
     {
@@ -75,6 +80,27 @@ namespace roads
         uint32_t volatile* addr = reinterpret_cast<uint32_t volatile*>(addr_val);
         return *addr;
     }
+
+    // The value to write into a DMA source or destination register in order
+    // to transfer from or to the given object.
+    inline uint32_t bus_address(void const* p)
+    {
+        return reinterpret_cast<uint32_t>(p);
+    }
+#else
+    // On the host the DMA controller is emulated by the host shims; writing
+    // a control register runs the transfer synchronously.
+    template <dma_offset_t Offset>
+    host::dma_register dma_reg()
+    {
+        return host::dma_register(Offset);
+    }
+
+    inline uintptr_t bus_address(void const* p)
+    {
+        return reinterpret_cast<uintptr_t>(p);
+    }
+#endif
 }
 
 #endif // DSR_DMACORE_H_
@@ -0,0 +1,147 @@
+#ifndef ROADS_FRAME_BUDGET_H
+#define ROADS_FRAME_BUDGET_H
+
+#include <cstddef>
+#include "glcore.h"
+
+namespace roads {
+    // How much geometry a list submits. Quad strips are counted in quads
+    // and triangle strips in triangles, so quads + triangles is the number
+    // of polygons the geometry engine stores; vertices is the number of
+    // vertices it stores, strips sharing theirs.
+    struct geometry_counts {
+        size_t quads, triangles, strip_vertices, vertices;
+
+        size_t polygons() const { return quads + triangles; }
+
+        geometry_counts& operator+=(geometry_counts const& rhs) {
+            quads += rhs.quads;
+            triangles += rhs.triangles;
+            strip_vertices += rhs.strip_vertices;
+            vertices += rhs.vertices;
+            return *this;
+        }
+    };
+
+    // Follows gfx_begin and the vertex commands the way the geometry engine
+    // assembles polygons out of them.
+    struct geometry_counter {
+        enum { no_primitive = -1 };
+
+        geometry_counts counts;
+        int primitive;
+        size_t in_primitive;
+
+        geometry_counter() : counts(), primitive(no_primitive), in_primitive(0) {}
+
+        void begin(int type) {
+            primitive = type;
+            in_primitive = 0;
+        }
+
+        void vertex() {
+            ++counts.vertices;
+            ++in_primitive;
+            switch(primitive) {
+            case gl_triangles:
+                if(in_primitive % 3 == 0)
+                    ++counts.triangles;
+                break;
+            case gl_quads:
+                if(in_primitive % 4 == 0)
+                    ++counts.quads;
+                break;
+            case gl_triangle_strip:
+                ++counts.strip_vertices;
+                if(in_primitive >= 3)
+                    ++counts.triangles;
+                break;
+            case gl_quad_strip:
+                ++counts.strip_vertices;
+                if(in_primitive >= 4 && in_primitive % 2 == 0)
+                    ++counts.quads;
+                break;
+            default:
+                break;
+            }
+        }
+    };
+
+    /*
+     * The geometry engine has room for 2048 polygons and 6144 vertices per
+     * frame; whatever is submitted beyond that silently disappears. A
+     * frame_budget is charged for every list before it is drawn, nearest
+     * first, and tells the caller whether to draw it:
+     *
+     *     budget.begin_frame();
+     *     if(budget.charge(ship_geometry))
+     *         ship.draw();
+     *     lvl.draw(budget);
+     *
+     * What happens to lists that don't fit depends on the policy:
+     * report_overflow draws them anyway and only sets overflowed,
+     * drop_farthest leaves them out, and cheaper_geometry has level::draw try
+     * the row's coarse list (see level::coarse_rows) before leaving it out.
+     * Either way level::draw stops at the first row it leaves out and leaves
+     * out every row behind it, so a near row is never missing while a
+     * farther one is drawn.
+     */
+    struct frame_budget {
+        enum overflow_policy {
+            report_overflow,
+            drop_farthest,
+            cheaper_geometry
+        };
+
+        enum {
+            max_polygons = 2048,
+            max_vertices = 6144
+        };
+
+        explicit frame_budget(overflow_policy policy = report_overflow,
+                              size_t polygon_limit = max_polygons,
+                              size_t vertex_limit = max_vertices)
+            : policy(policy), polygon_limit(polygon_limit), vertex_limit(vertex_limit),
+              used(), overflowed(false), degraded(0), dropped(0)
+        {
+        }
+
+        void begin_frame() {
+            used = geometry_counts();
+            overflowed = false;
+            degraded = 0;
+            dropped = 0;
+        }
+
+        bool fits(geometry_counts const& g) const {
+            return used.polygons() + g.polygons() <= polygon_limit
+                && used.vertices + g.vertices <= vertex_limit;
+        }
+
+        // Adds the geometry to this frame's total if it fits or the policy
+        // is report_overflow, and returns whether it should be drawn.
+        bool charge(geometry_counts const& g) {
+            if(fits(g)) {
+                used += g;
+                return true;
+            }
+            overflowed = true;
+            if(policy == report_overflow) {
+                used += g;
+                return true;
+            }
+            return false;
+        }
+
+        overflow_policy policy;
+        size_t polygon_limit, vertex_limit;
+
+        // This frame so far.
+        geometry_counts used;
+        bool overflowed;
+        size_t degraded; // lists replaced by cheaper ones
+        size_t dropped;  // lists left out
+    };
+}
+
+#endif // ROADS_FRAME_BUDGET_H
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+
+#include "frame_linker.h"
+#include "display_list.h"
+#include "static_list.h"
+#include "cache.h"
+#include "glcore.h"
+
+namespace roads
+{
+    frame_linker::frame_linker()
+        : buffers(), used(), current(0), uncached(false), queue(0), fences(),
+          scale(1, 1, 1), position(), positioned(false)
+    {
+    }
+
+    frame_linker::~frame_linker()
+    {
+        for(unsigned i = 0; i < 2; ++i)
+            std::free(buffers[i].words);
+    }
+
+    void frame_linker::set_uncached(bool on)
+    {
+        if(on && !uncached) {
+            // Neither buffer may have dirty lines left that could later be
+            // written back over what goes through the mirror.
+            for(unsigned i = 0; i < 2; ++i)
+                if(buffers[i].words)
+                    DC_FlushRange(buffers[i].words, buffers[i].capacity * 4);
+        }
+        uncached = on;
+    }
+
+    uint32_t* frame_linker::reserve(size_t count)
+    {
+        buffer& buf = buffers[current];
+        size_t const n = used[current];
+        if(n + count > buf.capacity) {
+            size_t const line_words = cache_line / 4;
+            size_t capacity = std::max(std::max(n + count, buf.capacity * 2), size_t(1024));
+            capacity = (capacity + line_words - 1) / line_words * line_words;
+            uint32_t* const words = static_cast<uint32_t*>(memalign(cache_line, capacity * 4));
+            // what was written through the mirror may not be in the cache
+            if(n > 0)
+                std::memcpy(words, uncached ? memUncached(buf.words) : buf.words, n * 4);
+            std::free(buf.words);
+            buf.words = words;
+            buf.capacity = capacity;
+            // the copy went through the cache
+            if(uncached)
+                DC_FlushRange(buf.words, buf.capacity * 4);
+        }
+
+        used[current] += count;
+        uint32_t* const p = buf.words + n;
+        return uncached ? static_cast<uint32_t*>(memUncached(p)) : p;
+    }
+
+    void frame_linker::begin(vector3f32 const& s)
+    {
+        current ^= 1;
+        if(queue)
+            while(!queue->reached(fences[current]));
+
+        used[current] = 0;
+        scale = s;
+        positioned = false;
+    }
+
+    void frame_linker::add_row(uint32_t const* words, size_t count, vector3f32 const& translation)
+    {
+        if(count == 0)
+            return;
+
+        if(!positioned) {
+            // the same as disp_writer's prelude
+            uint32_t* out = reserve(15);
+            *out++ = fifo_pack(gfx_matrix_push, gfx_matrix_mult_4x3, gfx_nop, gfx_nop);
+            *out++ = raw(scale.x); *out++ =            0; *out++ =            0;
+            *out++ =            0; *out++ = raw(scale.y); *out++ =            0;
+            *out++ =            0; *out++ =            0; *out++ = raw(scale.z);
+            *out++ = raw(translation.x); *out++ = raw(translation.y); *out++ = raw(translation.z);
+            // params for the nops
+            *out++ = 0; *out++ = 0;
+            positioned = true;
+        }
+        else if(translation.x != position.x || translation.y != position.y || translation.z != position.z) {
+            // The translation is applied before the scale, so it has to be
+            // given in scaled units.
+            uint32_t* out = reserve(7);
+            *out++ = fifo_pack(gfx_matrix_trans, gfx_nop, gfx_nop, gfx_nop);
+            *out++ = raw((translation.x - position.x) / scale.x);
+            *out++ = raw((translation.y - position.y) / scale.y);
+            *out++ = raw((translation.z - position.z) / scale.z);
+            *out++ = 0; *out++ = 0; *out++ = 0;
+        }
+        position = translation;
+
+        add(words, count);
+    }
+
+    void frame_linker::add(display_list const& lst)
+    {
+        add(lst.data(), lst.size());
+    }
+
+    void frame_linker::add(uint32_t const* words, size_t count)
+    {
+        if(count > 0)
+            std::copy(words, words + count, reserve(count));
+    }
+
+    void frame_linker::end()
+    {
+        if(positioned) {
+            uint32_t* out = reserve(5);
+            *out++ = fifo_pack(gfx_matrix_pop, gfx_nop, gfx_nop, gfx_nop);
+            *out++ = 1;
+            *out++ = 0; *out++ = 0; *out++ = 0;
+            positioned = false;
+        }
+    }
+
+    void frame_linker::draw() const
+    {
+        if(size() == 0)
+            return;
+
+        if(!uncached)
+            DC_FlushRange(data(), size() * 4);
+        draw_words(data(), size());
+    }
+
+    void frame_linker::submit(dma_queue& q)
+    {
+        if(size() == 0)
+            return;
+
+        if(!uncached)
+            DC_FlushRange(data(), size() * 4);
+        q.submit(data(), size());
+        queue = &q;
+        fences[current] = q.fence();
+    }
+}
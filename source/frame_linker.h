@@ -0,0 +1,98 @@
+#ifndef ROADS_FRAME_LINKER_H
+#define ROADS_FRAME_LINKER_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "vector.h"
+#include "fixed16.h"
+#include "dma_queue.h"
+
+namespace roads {
+    struct display_list;
+
+    /*
+     * Joins the lists of a frame into one stream, so that the whole frame
+     * goes to the geometry engine with a single cache flush and a single
+     * DMA instead of one of each per row.
+     *
+     * Level rows are kept without a matrix of their own (see
+     * level::write_row_list). The linker pushes one matrix for the first
+     * row it is given and moves it on to each following row with a
+     * gfx_matrix_trans by the difference of the two rows' translations,
+     * popping it at the end. Lists that do set up their own matrix, such as
+     * the ship's, are copied in as they are:
+     *
+     *     linker.begin(geometry::draw::scale);
+     *     for(display_row const& row : rows)
+     *         linker.add_row(row.data.data(), row.data.size(), row.translation);
+     *     linker.add(ship);
+     *     linker.end();
+     *     linker.submit(queue);      // or draw()
+     *
+     * The linker alternates between two buffers, so the next frame can be
+     * linked while the last one is still being sent; begin() only waits if
+     * the frame before that one still is.
+     *
+     * A frame is written front to back exactly once and never read by the
+     * CPU, so with set_uncached the linker writes it through the uncached
+     * mirror of main RAM and nothing has to be flushed before the DMA. The
+     * buffers are only flushed when they grow. They start on a cache line
+     * and fill whole lines, so that no other data written through the cache
+     * shares a line with them whose write-back could land on the frame.
+     * Whether that beats writing
+     * through the cache and flushing the whole frame depends on how well
+     * the write buffer keeps up, so both are kept; the row scratch memory,
+     * which the repacker reads back, always stays cached.
+     */
+    struct frame_linker {
+        frame_linker();
+        ~frame_linker();
+
+        // Starts a new frame whose rows are all drawn at the given scale.
+        void begin(vector3f32 const& scale);
+        void add_row(uint32_t const* words, size_t count, vector3f32 const& translation);
+        void add(display_list const& lst);
+        void add(uint32_t const* words, size_t count);
+        void end();
+
+        uint32_t const* data() const { return size() ? buffers[current].words : 0; }
+        size_t size() const { return used[current]; }
+
+        void set_uncached(bool on);
+        bool get_uncached() const { return uncached; }
+
+        void draw() const;
+        // The frame has to stay as it is until the queue is done with it,
+        // which begin() takes care of.
+        void submit(dma_queue& queue);
+
+        frame_linker(frame_linker const&) = delete;
+        frame_linker& operator=(frame_linker const&) = delete;
+
+    private:
+        enum { cache_line = 32 };
+
+        struct buffer {
+            uint32_t* words;
+            size_t capacity;
+        };
+
+        // Makes room for count more words and returns where to write them.
+        uint32_t* reserve(size_t count);
+
+        buffer buffers[2];
+        size_t used[2];
+        unsigned current;
+        bool uncached;
+        dma_queue const* queue;
+        dma_queue::fence_t fences[2];
+
+        vector3f32 scale;
+        // the translation of the last row, if the row matrix has been
+        // pushed
+        vector3f32 position;
+        bool positioned;
+    };
+}
+
+#endif // ROADS_FRAME_LINKER_H
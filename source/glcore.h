@@ -107,11 +107,10 @@ namespace roads
     gfx_reg()
     {
         typedef typename detail::reg_type<Offset>::addr_type addr_type;
-        typedef typename detail::reg_type<Offset>::result_type result_type;
 
         // All enumeration values are specified as offsets from gfx_address_base (0x04000000, also the general hardware IO address base)
         uint32_t const addr = gfx_address_base + Offset;
-        addr_type ptr = reinterpret_cast<addr_type>(addr);
+        addr_type ptr = detail::io_pointer<addr_type>(addr);
         return detail::reg_type<Offset>::apply(ptr);
     }
 
@@ -1,108 +1,321 @@
 #include "level.h"
 
 #include <algorithm>
+#include <cassert>
+#include <cstring>
 #include "geometry.h"
 #include "disp_writer.h"
+#include "command_stream.h"
 
 namespace roads {
+    namespace {
+        char const header_text[] = "DSRoads Level file v0.003\n";
 
-    void level::draw() const {
-        for(display_row const& dl : draw_queue)
-            if(dl.depth > 0)
-                dl.data.draw();
+        bool same_cell(cell a, cell b) {
+            return a.tile_color == b.tile_color && a.block_color == b.block_color
+                && a.altitude == b.altitude && a.flags == b.flags;
+        }
+
+        // The faces of the cell at grid[row][col] that the cells around it
+        // cover: the front one by the cell in front of it, and a side one by
+        // the cells next to it along the whole run.
+        unsigned hidden_faces(grid_t const& grid, size_t row, size_t col) {
+            cell_aux const& aux = grid[row][col];
+            unsigned hidden = 0;
+            if(row > 0 && !aux.data.face_required(grid[row - 1][col].data))
+                hidden |= draw_cell::hide_front;
+
+            bool left = col > 0, right = col + 1 < row_t().size();
+            for(int i = 0; i < aux.depth; ++i) {
+                row_t const& r = grid[row + i];
+                left = left && !aux.data.side_required(r[col - 1].data);
+                right = right && !aux.data.side_required(r[col + 1].data);
+            }
+            if(left)
+                hidden |= draw_cell::hide_left;
+            if(right)
+                hidden |= draw_cell::hide_right;
+            return hidden;
+        }
+
+        // The sides of the cells in column col that face away from the
+        // camera, which stays at x = 0 (see level::row_translation): the
+        // left ones of the columns left of it and the right ones of the
+        // columns right of it. The centre column's tunnel shell curves
+        // towards the camera on both sides, so it keeps them.
+        unsigned facing_away(size_t col) {
+            size_t const columns = row_t().size();
+            if(2 * (col + 1) <= columns)
+                return draw_cell::away_left;
+            if(2 * col >= columns)
+                return draw_cell::away_right;
+            return 0;
+        }
+
+        // The greatest depth among the cells of the row, which is how far
+        // its runs reach.
+        int row_depth(row_t const& row) {
+            int depth = 0;
+            for(cell_aux const& aux : row)
+                depth = std::max(depth, aux.depth);
+            return depth;
+        }
+
+        // Writes the cells of one row and returns the greatest depth among
+        // them.
+        template <typename Sink>
+        int write_row(basic_disp_writer<Sink>& writer, grid_t const& grid, size_t row, bool coarse, bool cull, bool away) {
+            using geometry::draw::block_size;
+
+            int depth = 0;
+            vector3f16 cell_offset { 0, 0, 0 };
+            for(size_t i = 0; i < grid[row].size(); ++i, cell_offset.x += block_size) {
+                cell_aux aux = grid[row][i];
+                if(aux.depth > 0) {
+                    depth = std::max(depth, aux.depth);
+                    unsigned hidden = cull ? hidden_faces(grid, row, i) : 0;
+                    if(away)
+                        hidden |= facing_away(i);
+                    writer << draw_cell { aux.data, cell_offset, { 1, 1, aux.depth }, coarse, hidden };
+                }
+            }
+
+            writer << end;
+            return depth;
+        }
+    }
+
+    grid_t make_grid(unsigned char const* level_data, size_t size, bool merge) {
+        constexpr size_t gravity_offset = countof(header_text) - 1;
+        constexpr size_t oxygen_leak_offset = gravity_offset + 2;
+        constexpr size_t palette_offset = oxygen_leak_offset + 2;
+        constexpr size_t grid_offset = palette_offset + (16 * sizeof(rgb));
+        size_t const cell_count = (size - grid_offset) / 2;
+        size_t const row_count = cell_count / 7;
+
+        std::memcpy(cell::palette, level_data + palette_offset, sizeof(rgb) * 16);
+        grid_t grid(row_count);
+        std::memcpy(&grid[0], level_data + grid_offset, size - grid_offset);
+        if(merge)
+            merge_runs(grid);
+
+        return grid;
     }
 
-    display_row level::get_display_row() {
-        if(!draw_pool.empty()) {
-            display_row ret = std::move(draw_pool.front());
-            draw_pool.pop_front();
-            return std::move(ret);
+    void merge_runs(grid_t& grid) {
+        for(size_t col = 0; col < row_t().size(); ++col) {
+            size_t row = 0;
+            while(row < grid.size()) {
+                cell_aux& first = grid[row][col];
+                if(first.depth == 0) {
+                    ++row;
+                    continue;
+                }
+
+                // The back face of the first cell is never drawn and the
+                // front faces of the others are hidden behind it, so one
+                // cell stretched over the run looks the same.
+                int depth = 1;
+                while(depth < cell_aux::max_depth && row + depth < grid.size()) {
+                    cell_aux& next = grid[row + depth][col];
+                    if(next.depth == 0 || !same_cell(next.data, first.data))
+                        break;
+                    next.depth = 0;
+                    ++depth;
+                }
+                first.depth = depth;
+                row += depth;
+            }
         }
+    }
 
-        return display_row();
+    void level::draw() {
+        // report_overflow draws everything
+        frame_budget unlimited;
+        draw(unlimited);
     }
 
-    void level::reset() {
-        for(display_row& r : draw_queue) {
-            draw_pool.push_back(std::move(r));
+    void level::draw(frame_budget& budget) {
+        link(budget);
+        frame.draw();
+    }
+
+    void level::submit(frame_budget& budget, dma_queue& queue) {
+        link(budget);
+        frame.submit(queue);
+    }
+
+    void level::link(frame_budget& budget) {
+        frame.begin(geometry::draw::scale);
+        // The rows go nearest first, so once one is left out, everything
+        // behind it is farther and goes too, however small. The row in
+        // front may also cover faces that were left out of those rows.
+        bool full = false;
+        for(display_row const& dl : draw_queue) {
+            if(dl.depth <= 0)
+                continue;
+
+            if(full) {
+                ++budget.dropped;
+            }
+            else if(budget.charge(dl.geometry)) {
+                frame.add_row(dl.data.data(), dl.data.size(), dl.translation);
+            }
+            else if(budget.policy == frame_budget::cheaper_geometry
+                 && dl.coarse.size() > 0 && budget.charge(dl.coarse_geometry)) {
+                frame.add_row(dl.coarse.data(), dl.coarse.size(), dl.translation);
+                ++budget.degraded;
+            }
+            else {
+                ++budget.dropped;
+                full = true;
+            }
+        }
+        frame.end();
+    }
+
+    void level::enter_row(grid_t::iterator rowp, display_row& slot) {
+        size_t const index = std::distance(grid.begin(), rowp);
+        for(evicted_row& e : evicted) {
+            if(e.index == index) {
+                slot = std::move(e.row);
+                e.index = evicted_row::none;
+                return;
+            }
         }
+        slot = generate_row_display_list(rowp);
+    }
+
+    // Nothing but the frame linker reads the rows, so the oldest evicted
+    // one can give its lists back to the slab right away.
+    void level::evict(display_row& row, grid_t::iterator rowp) {
+        evicted_row& e = evicted[next_evicted];
+        next_evicted = (next_evicted + 1) % evicted.size();
+        e.row.clear();
+        e.row = std::move(row);
+        e.index = std::distance(grid.begin(), rowp);
+    }
+
+    void level::reset() {
         draw_queue.clear();
+        for(evicted_row& e : evicted) {
+            e.row.clear();
+            e.index = evicted_row::none;
+        }
         visible_start = grid.begin();
         visible_end = grid.begin();
     }
 
     display_row level::generate_row_display_list(grid_t::iterator rowp) {
+        display_row result;
+        result.translation = row_translation(rowp);
+        size_t const index = std::distance(grid.begin(), rowp);
+        if(baked && index < baked->size() && baked->flags() == row_flags()) {
+            // The frame linker copies the words into the frame, so they
+            // can stay wherever the file was loaded.
+            baked_rows::row const r = (*baked)[index];
+            result.data = slab_list::external(r.words, r.count);
+            result.geometry = r.geometry;
+            result.depth = r.depth;
+        }
+        else {
+            result.geometry = write_row_list(rowp, false, result.data, result.depth);
+        }
+        if(coarse_rows) {
+            int depth;
+            result.coarse_geometry = write_row_list(rowp, true, result.coarse, depth);
+        }
+        else {
+            result.coarse.clear();
+            result.coarse_geometry = geometry_counts();
+        }
+        return result;
+    }
+
+    vector3f32 level::row_translation(grid_t::const_iterator rowp) const {
         using geometry::draw::block_size;
 
-        display_row result = get_display_row();
-        result.depth = 0;
-        // This is a rather liberal estimate and it should be possible to
-        // cut it down quite a bit. With this the draw lists will take up a
-        // maximum of 2048 * sizeof(uint32_t) * draw_distance = 200KiB of
-        // memory.
-        result.data.resize(2048); 
         // center x and set z distance to how far along the row is
         f16 const xoff = -(rowp->size() / 2.) * block_size;
-        vector3f32 const translation(
+        return vector3f32(
             xoff,
             0,
             -f32(block_size) * std::distance(grid.begin(), rowp));
+    }
 
-        disp_writer writer(result.data, translation, geometry::draw::scale);
+    geometry_counts level::write_row_list(grid_t::iterator rowp, bool coarse, slab_list& out, int& depth) {
+        // The chunks never fill up, so however much geometry the row has
+        // all of it ends up in the list, and the list gets exactly as much
+        // memory as it needs.
+        chunk_disp_writer writer(chunk_sink(row_scratch), row_translation(rowp), geometry::draw::scale);
+        writer.set_strip_builder(&row_strips);
+        depth = write_row(writer, grid, rowp - grid.begin(), coarse, cull_hidden, cull_facing_away);
+        assert(writer);
 
-        vector3f16 cell_offset { 0, 0, 0 };
-        for(size_t i = 0; i < rowp->size(); ++i, cell_offset.x += block_size) {
-            cell_aux aux = (*rowp)[i];
-            if(aux.depth > 0) {
-                result.depth = std::max(result.depth, aux.depth);
-                writer << draw_cell { aux.data, cell_offset, { 1, 1, aux.depth } };
-            }
-        }
+        // Repack the commands without the nops the writer padded its packs
+        // with. Packs never cross chunks, so each chunk decodes by itself.
+        row_commands.clear();
+        row_words.clear();
+        for(size_t i = 0; i < row_scratch.chunk_count(); ++i)
+            decode_commands(row_scratch[i].words, row_scratch[i].used, row_commands);
 
-        writer << end;
+        // The matrix push and multiply the writer starts with and the pop it
+        // ends with are left to frame_linker.
+        assert(row_commands.size() >= 3
+            && row_commands[0].id == id(gfx_matrix_push)
+            && row_commands[1].id == id(gfx_matrix_mult_4x3)
+            && row_commands.back().id == id(gfx_matrix_pop));
+        row_commands.pop_back();
+        row_commands.erase(row_commands.begin(), row_commands.begin() + 2);
+        encode_commands(row_commands, row_words);
 
-        result.data.resize(writer.write_count());
+        out = row_slab.allocate(row_words.size());
+        std::copy(row_words.begin(), row_words.end(), out.data());
 
-        return std::move(result);
+        return writer.geometry();
     }
 
     void level::update(f32 position) {
         // note: z is negative forward so we negate the position for grid indexing
-        grid_t::iterator start = grid.begin() + std::min(floor(-position / f32(geometry::draw::block_size)).to_int(), int32_t(grid.size()));
-        grid_t::iterator end = grid.begin() + std::min(std::distance(grid.begin(), start) + draw_distance, int32_t(grid.size()));
-
-        if(start > visible_start) {
-            // drop as many rows as we can from the start
-            auto front = draw_queue.begin();
-            for(; visible_start < start; ++visible_start) {
-                if(front->depth == 0) {
-                    draw_pool.push_back(std::move(draw_queue.front()));
-                    draw_queue.pop_front();
-                }
-                else if(front->depth <= (start - visible_start)) {
-                    draw_pool.push_back(std::move(draw_queue.front()));
-                    draw_queue.pop_front();
-                }
-                else {
-                    break;
-                }
-            }
-            start = visible_start;
+        grid_t::iterator start = grid.begin() + std::max(std::min(floor(-position / f32(geometry::draw::block_size)).to_int(), int32_t(grid.size())), int32_t(0));
+        grid_t::iterator end = grid.begin() + std::min(int32_t(std::distance(grid.begin(), start)) + draw_distance, int32_t(grid.size()));
+
+        // The rows before start whose runs reach it are needed as well.
+        grid_t::iterator first = start;
+        for(grid_t::iterator row = start; row != grid.begin() && start - row < cell_aux::max_depth; ) {
+            --row;
+            if(row_depth(*row) > start - row)
+                first = row;
         }
-        else if(start < visible_start) {
-            // going backwards?
-            // TODO
+
+        // going forwards: drop as many rows as we can from the start
+        while(visible_start < start && visible_start < visible_end) {
+            int const depth = draw_queue.front().depth;
+            if(depth > start - visible_start)
+                break;
+            evict(draw_queue.front(), visible_start++);
+            draw_queue.pop_front();
         }
 
-        if(end > visible_end) {
-            for(; visible_end < end; ++visible_end) {
-                draw_queue.push_back(generate_row_display_list(visible_end));
-            }
+        // going backwards: drop the rows past the end
+        while(visible_end > end && visible_end > visible_start) {
+            evict(draw_queue.back(), --visible_end);
+            draw_queue.pop_back();
         }
-        else if(end < visible_end) {
-            // going backwards?
-            // TODO
+
+        // The window may have moved past all of its rows.
+        if(visible_start == visible_end)
+            visible_start = visible_end = first;
+
+        // going backwards: the rows coming in at the start, nearest last
+        while(visible_start > first) {
+            --visible_start;
+            enter_row(visible_start, draw_queue.push_front());
         }
+
+        // going forwards: the rows coming in at the end
+        for(; visible_end < end; ++visible_end)
+            enter_row(visible_end, draw_queue.push_back());
     }
 }
 
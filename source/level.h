@@ -2,13 +2,22 @@
 #define ROADS_LEVEL_H
 
 #include <array>
+#include <cassert>
+#include <memory>
 #include <vector>
-#include <list>
 
 #include "cell.h"
 #include "vector.h"
 #include "fixed16.h"
 #include "display_list.h"
+#include "chunk_arena.h"
+#include "command_stream.h"
+#include "frame_budget.h"
+#include "strip_builder.h"
+#include "dma_queue.h"
+#include "frame_linker.h"
+#include "command_slab.h"
+#include "baked_rows.h"
 
 namespace roads {
     struct cell_aux {
@@ -16,8 +25,13 @@ namespace roads {
         // be augmented with the number of identical cells that follow it in
         // the upcoming rows, and the matching cells in the upcoming rows will
         // be marked with depth = 0 so that they will not be drawn at all.
+        // See merge_runs.
         int depth;
         cell data;
+
+        // draw_cell stretches a run along z with an f16 scale, which can't
+        // reach 8
+        enum { max_depth = 7 };
     };
     typedef std::array<cell_aux, 7> row_t;
     typedef std::vector<row_t> grid_t;
@@ -26,48 +40,240 @@ namespace roads {
         // maximum depth of any of its cells so that the row's display data is
         // not prematurely purged when the player is moving forward.
         int depth;
-        display_list data;
+        // The row's commands without a matrix of their own; frame_linker
+        // moves the row matrix to translation before them.
+        slab_list data;
+        geometry_counts geometry;
+        // The row without its side faces and with flat tunnel roofs, only
+        // generated when level::coarse_rows is set.
+        slab_list coarse;
+        geometry_counts coarse_geometry;
+        vector3f32 translation;
 
-        display_row() : depth(), data() {}
+        display_row() : depth(), data(), geometry(), coarse(), coarse_geometry(), translation() {}
         display_row(display_row&& rhs)
-            : depth(rhs.depth), data(std::move(rhs.data)) { rhs.depth = 0; }
+            : depth(rhs.depth), data(std::move(rhs.data)), geometry(rhs.geometry),
+              coarse(std::move(rhs.coarse)), coarse_geometry(rhs.coarse_geometry),
+              translation(rhs.translation) { rhs.depth = 0; }
         display_row& operator=(display_row&& rhs) {
             depth = rhs.depth;
+            translation = rhs.translation;
             data = std::move(rhs.data);
+            geometry = rhs.geometry;
+            coarse = std::move(rhs.coarse);
+            coarse_geometry = rhs.coarse_geometry;
             rhs.depth = 0;
             return *this;
         }
 
+        // Gives the lists back to the slab.
+        void clear() {
+            data.clear();
+            coarse.clear();
+        }
+
         display_row(display_row const&) = delete;
         display_row& operator=(display_row const&) = delete;
     };
-    typedef std::list<display_row> draw_queue_t;
+
+    /*
+     * The rows of the visible window, nearest first, in a ring of slots
+     * allocated once with the level. Rows are moved into a slot as they come
+     * into the window and out of it as they leave, so moving the window
+     * allocates nothing and the rows sit next to each other in the order
+     * level::draw walks them.
+     */
+    struct row_ring {
+        template <typename Ring, typename Row>
+        struct basic_iterator {
+            Ring* ring;
+            size_t index;
+
+            Row& operator*() const { return (*ring)[index]; }
+            Row* operator->() const { return &(*ring)[index]; }
+            basic_iterator& operator++() { ++index; return *this; }
+            bool operator==(basic_iterator const& rhs) const { return index == rhs.index; }
+            bool operator!=(basic_iterator const& rhs) const { return index != rhs.index; }
+        };
+        typedef basic_iterator<row_ring, display_row> iterator;
+        typedef basic_iterator<row_ring const, display_row const> const_iterator;
+
+        explicit row_ring(size_t capacity)
+            : slots(new display_row[capacity]), capacity(capacity), first(0), count(0)
+        {
+        }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        display_row& operator[](size_t i) { return slots[(first + i) % capacity]; }
+        display_row const& operator[](size_t i) const { return slots[(first + i) % capacity]; }
+        display_row& front() { return (*this)[0]; }
+        display_row& back() { return (*this)[count - 1]; }
+
+        iterator begin() { return iterator { this, 0 }; }
+        iterator end() { return iterator { this, count }; }
+        const_iterator begin() const { return const_iterator { this, 0 }; }
+        const_iterator end() const { return const_iterator { this, count }; }
+
+        // The empty slot for a row coming in at either end.
+        display_row& push_front() {
+            assert(count < capacity);
+            first = (first + capacity - 1) % capacity;
+            ++count;
+            return slots[first];
+        }
+        display_row& push_back() {
+            assert(count < capacity);
+            ++count;
+            return back();
+        }
+
+        // Gives the lists of a row still in the slot back to the slab.
+        void pop_front() {
+            slots[first].clear();
+            first = (first + 1) % capacity;
+            --count;
+        }
+        void pop_back() {
+            back().clear();
+            --count;
+        }
+        void clear() {
+            while(count > 0)
+                pop_back();
+        }
+
+        row_ring(row_ring const&) = delete;
+        row_ring& operator=(row_ring const&) = delete;
+
+    private:
+        std::unique_ptr<display_row[]> slots;
+        size_t capacity;
+        size_t first, count;
+    };
+    typedef row_ring draw_queue_t;
+
+    // Builds the grid from the raw contents of a level file and loads the
+    // level's palette into cell::palette. Unless told otherwise, runs of
+    // identical cells are merged as well.
+    grid_t make_grid(unsigned char const* level_data, size_t size, bool merge = true);
+
+    // Gives the first cell of each run of identical cells down a column the
+    // length of the run as its depth, up to cell_aux::max_depth, and the
+    // rest of the run depth 0. Cells that already have depth 0 are left
+    // alone and end runs.
+    void merge_runs(grid_t& grid);
 
     struct level {
-        void draw() const;
+        // The visible rows are linked into one stream (see frame_linker.h)
+        // and sent with a single DMA.
+        void draw();
+        // Draws the rows nearest first, charging each to the budget and
+        // leaving out or replacing the ones it has no room for.
+        void draw(frame_budget& budget);
+        // The same, but through the queue, so that it returns before the
+        // frame has been sent.
+        void submit(frame_budget& budget, dma_queue& queue);
+        // Moves the window of rows to position, in either direction. Rows
+        // that come back soon after leaving it aren't generated again.
         void update(f32 position);
         void reset();
+        // Takes the rows' full lists from the baked file instead of
+        // generating them, or generates them again when given 0. The file
+        // has to have been loaded against this level's data, and is only
+        // used while row_flags() matches the flags it was baked with.
+        // Takes effect for rows generated after it is set.
+        void use_baked(baked_rows const* rows) { baked = rows; }
+
+        // The culling settings rows are generated with, as baked files
+        // record them.
+        enum {
+            rows_cull_hidden = 1,
+            rows_cull_facing_away = 2
+        };
+        unsigned row_flags() const {
+            return (cull_hidden ? rows_cull_hidden : 0)
+                 | (cull_facing_away ? rows_cull_facing_away : 0);
+        }
 
         enum {
-            draw_distance = 25
+            draw_distance = 25,
+            // rows kept after leaving the window, for when it comes back
+            evicted_rows = 8,
+            // The window reaches back from the draw distance to the first
+            // row whose runs reach the camera.
+            window_rows = draw_distance + cell_aux::max_depth
         };
 
         level(grid_t&& src_grid)
             : grid(std::move(src_grid)),
               visible_start(grid.begin()),
-              visible_end(grid.begin())
+              visible_end(grid.begin()),
+              draw_queue(window_rows),
+              coarse_rows(false),
+              cull_hidden(true),
+              cull_facing_away(true),
+              baked(0),
+              next_evicted(0)
         {
         }
 
     //private:
         grid_t grid;
         grid_t::iterator visible_start, visible_end;
+        // The rows' lists; declared before the rows so that it outlives
+        // them.
+        command_slab row_slab;
         draw_queue_t draw_queue;
-        // pool up our display data buffers to avoid unnecessary allocations
-        draw_queue_t draw_pool;
+        // rows are written here first, then repacked into a list of the
+        // right size
+        chunk_arena row_scratch;
+        std::vector<decoded_command> row_commands;
+        std::vector<uint32_t> row_words;
+        strip_builder row_strips;
+        // Whether rows also get a coarse list, for the cheaper_geometry
+        // overflow policy. Takes effect for rows generated after it is set.
+        bool coarse_rows;
+        // Whether faces that neighbouring cells cover are left out of the
+        // rows (see cell::face_required). Takes effect for rows generated
+        // after it is set.
+        bool cull_hidden;
+        // Whether the side faces of the columns off the centre that face
+        // away from the camera are left out of the rows. The camera only
+        // moves along z, so they never turn towards it. Takes effect for
+        // rows generated after it is set.
+        bool cull_facing_away;
+        baked_rows const* baked;
+
+        // The rows that left the window last, in case it moves back over
+        // them before they are pushed out; see update.
+        struct evicted_row {
+            static size_t const none = size_t(-1);
 
-        display_row get_display_row();
+            evicted_row() : index(none), row() {}
+
+            size_t index;               // in grid, or none
+            display_row row;
+        };
+        std::array<evicted_row, evicted_rows> evicted;
+        size_t next_evicted;
+
+        // Fills a slot of draw_queue with the row, back from evicted if it
+        // is there and generated otherwise.
+        void enter_row(grid_t::iterator rowp, display_row& slot);
+        // Moves the row from its slot of draw_queue into evicted, pushing
+        // out the oldest one there.
+        void evict(display_row& row, grid_t::iterator rowp);
+        // Links the rows that fit in the budget into frame.
+        void link(frame_budget& budget);
+        frame_linker frame;
         display_row generate_row_display_list(grid_t::iterator rowp);
+
+        vector3f32 row_translation(grid_t::const_iterator rowp) const;
+        // Writes the row into row_scratch, repacks it into out without the
+        // matrix commands and returns its geometry.
+        geometry_counts write_row_list(grid_t::iterator rowp, bool coarse, slab_list& out, int& depth);
     };
 }
 
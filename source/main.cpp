@@ -47,32 +47,34 @@ int main(void) {
 #include "collide.h"
 #include "geometry.h"
 #include "disp_writer.h"
+#include "ship_shape.h"
+#include "dma_queue.h"
+#include "baked_rows.h"
 
 namespace roads {
     constexpr f32 move_unit = 0.0005;
+
+    // glPopMatrix(1) and glFlush(0), queued behind the frame's rows
+    struct frame_end : static_list<
+        static_cmd<gfx_matrix_pop, 1>,
+        static_cmd<gfx_flush, 0>
+    > {};
 }
 
 extern const unsigned char level_data_test0[15182];
 extern const unsigned char level_data_test2[6278];
-static const char headerText[] = "DSRoads Level file v0.003\n";
 
 #define LEVEL_NAME level_data_test2
 
-roads::grid_t make_level_data() {
-    using namespace roads;
-
-    constexpr size_t gravity_offset = countof(headerText) - 1;
-    constexpr size_t oxygen_leak_offset = gravity_offset + 2;
-    constexpr size_t palette_offset = oxygen_leak_offset + 2;
-    constexpr size_t grid_offset = palette_offset + (16 * sizeof(rgb));
-    constexpr size_t cell_count = (countof(LEVEL_NAME) - grid_offset) / 2;
-    constexpr size_t row_count = cell_count / 7;
-
-    memcpy(cell::palette, LEVEL_NAME + palette_offset, sizeof(rgb) * 16);
-    grid_t grid(row_count);
-    memcpy(&grid[0], LEVEL_NAME + grid_offset, countof(LEVEL_NAME) - grid_offset);
+// Set by the Makefile when `make -C host bake` has put the level's rows in
+// data/.
+#if ROADS_BAKED_ROWS
+extern const unsigned char test2_rows_bin[];
+extern const unsigned int test2_rows_bin_size;
+#endif
 
-    return std::move(grid);
+roads::grid_t make_level_data() {
+    return roads::make_grid(LEVEL_NAME, countof(LEVEL_NAME));
 }
 
 int already, corr, fell, none;
@@ -245,6 +247,14 @@ int main() {
 	//any floating point gl call is being converted to fixed prior to being implemented
 
     roads::level lvl { make_level_data() };
+    // the frame is only ever written by the linker and read by the DMA
+    lvl.frame.set_uncached(true);
+#if ROADS_BAKED_ROWS
+    // rows baked from some other version of the level are generated instead
+    roads::baked_rows baked;
+    if(baked.load(test2_rows_bin, test2_rows_bin_size, LEVEL_NAME, countof(LEVEL_NAME)))
+        lvl.use_baked(&baked);
+#endif
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	gluPerspective(70, 256.0 / 192.0, 0.1, 40);
@@ -260,6 +270,9 @@ int main() {
             floattov10(ln.x), floattov10(ln.y), floattov10(ln.z));
 	glPolyFmt(POLY_ALPHA(31) | POLY_CULL_BACK | POLY_FORMAT_LIGHT0);
 
+    roads::dma_queue gx_queue;
+    gx_queue.install();
+
     while(1) {
         lvl.reset();
     //roads::display_list list = generate_list();
@@ -269,6 +282,8 @@ int main() {
 
     roads::display_list ship;
     ship.resize(128);
+    roads::geometry_counts ship_geometry;
+    roads::patch_slot ship_position;
 
     {
         using namespace roads;
@@ -277,21 +292,14 @@ int main() {
         move.y = geometry::draw::tile_height * 5;
         move.z = ship_size.z * f32(0.5) - f32(geometry::draw::block_size) * f32(0.5);
         disp_writer writer(ship, move, geometry::draw::scale);
-
-        f16 x = f16(raw(ship_size.x), raw_tag);
-        f16 y = f16(raw(ship_size.y), raw_tag);
-        f16 z = f16(raw(ship_size.z), raw_tag);
-
-        writer
-            << diffuse_ambient { make_rgb(31, 0, 0), make_rgb(10, 10, 10), true }
-            << quad { { 0, 0, z }, { x, 0, z }, { x, y, z }, { 0, y, z } }
-            << quad { { 0, 0, z }, { 0, y, z }, { 0, y, 0 }, { 0, 0, 0 } }
-            << quad { { 0, y, z }, { x, y, z }, { x, y, 0 }, { 0, y, 0 } }
-            << quad { { x, 0, z }, { x, 0, 0 }, { x, y, 0 }, { x, y, z } }
-            << end;
+        ship_position = writer.translation_slot();
+        writer << ship_shape::mesh() << end;
         ship.resize(writer.write_count());
+        ship_geometry = writer.geometry();
     }
 
+    roads::frame_budget budget(roads::frame_budget::drop_farthest);
+
     using roads::move_unit;
     roads::vector3f32 acceleration { 0, -move_unit, 0 }; // gravity
     roads::vector3f32 velocity { 0, 0, 0 };
@@ -323,11 +331,10 @@ int main() {
             "                                \n");
 	while(game_on)
 	{
-		glPushMatrix();
-				
-        if(update_camera)
-            glTranslatef32(0, 0, raw(-move.z));
-		
+        // the camera follows where the ship was at the end of the last frame
+        bool const move_camera = update_camera;
+        f32 const camera_z = move.z;
+
 		scanKeys();
 		u16 keys = keysHeld();
 		if(keys & KEY_UP)    { acceleration.z = -move_unit; }
@@ -371,28 +378,45 @@ int main() {
         // updating the level's draw lists should be delayed a little so that rows
         // don't disappear while they're still on screen
         lvl.update(clamp(f32(0.3) + move.z, f32(INT_MIN, roads::raw_tag), f32(0)));
-        lvl.draw();
 
-        ship.data()[10] = raw(move.x);
-        ship.data()[11] = raw(move.y);
-        ship.data()[12] = raw(move.z);
-        //ship.draw();
+        // Everything up to here ran while last frame's lists were still
+        // being sent; the commands below go to the FIFO directly.
+        gx_queue.wait_idle();
+
+		glPushMatrix();
+				
+        if(move_camera)
+            glTranslatef32(0, 0, raw(-camera_z));
 
         draw_last_bounds();
 
+        // the ship is charged first so that it's never the one left out
+        budget.begin_frame();
+        bool const ship_fits = budget.charge(ship_geometry);
+        lvl.submit(budget, gx_queue);
+
+        // The queue is done with last frame's ship, since wait_idle
+        // returned before the level went in.
+        if(ship_fits) {
+            ship.patch(ship_position, move);
+            ship.submit(gx_queue);
+        }
+
+        iprintf("\x1b[23;0H"
+                "polygons %4u %s",
+                unsigned(budget.used.polygons()),
+                budget.overflowed ? "over budget" : "           ");
+
         //iprintf("\x1b[1;2H"
         //        "grid size: %d\n"
         //        "drawq size: %d\n"
-        //        "drawp size: %d\n"
         //        "dist: %d\n",
         //        lvl.grid.size(),
         //        lvl.draw_queue.size(),
-        //        lvl.draw_pool.size(),
         //        (lvl.visible_end - lvl.visible_start));
 
-		glPopMatrix(1);
-			
-		glFlush(0);
+        // pops the camera and swaps the buffers once the rows are through
+        frame_end::submit(gx_queue);
 	}
 
     while(1) {
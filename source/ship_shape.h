@@ -0,0 +1,27 @@
+#ifndef ROADS_SHIP_SHAPE_H
+#define ROADS_SHIP_SHAPE_H
+
+#include "static_list.h"
+#include "geometry.h"
+#include "utility.h"
+
+namespace roads {
+    // The ship is a box that never changes shape, so its list is packed at
+    // compile time and copied in after the per-frame translation.
+    namespace ship_shape {
+        constexpr int16_t x = raw(geometry::draw::ship_size.x);
+        constexpr int16_t y = raw(geometry::draw::ship_size.y);
+        constexpr int16_t z = raw(geometry::draw::ship_size.z);
+
+        struct mesh : static_list<
+            static_diffuse_ambient<make_rgb(31, 0, 0), make_rgb(10, 10, 10), true>,
+            static_cmd<gfx_begin, gl_quads>,
+            static_vertex<0, 0, z>, static_vertex<x, 0, z>, static_vertex<x, y, z>, static_vertex<0, y, z>,
+            static_vertex<0, 0, z>, static_vertex<0, y, z>, static_vertex<0, y, 0>, static_vertex<0, 0, 0>,
+            static_vertex<0, y, z>, static_vertex<x, y, z>, static_vertex<x, y, 0>, static_vertex<0, y, 0>,
+            static_vertex<x, 0, z>, static_vertex<x, 0, 0>, static_vertex<x, y, 0>, static_vertex<x, y, z>
+        > {};
+    }
+}
+
+#endif // ROADS_SHIP_SHAPE_H
@@ -0,0 +1,225 @@
+#ifndef ROADS_STATIC_LIST_H
+#define ROADS_STATIC_LIST_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "glcore.h"
+#include "utility.h"
+#include "dma_queue.h"
+
+namespace roads {
+    /*
+     * Compile-time display lists for geometry that never changes.
+     *
+     * A static_list packs a fixed sequence of commands into a
+     * static const uint32_t[] in exactly the layout that disp_writer
+     * produces: four command ids per fifo_pack header followed by their
+     * parameters, missing commands padded with a nop and a zero parameter,
+     * and a parameterless command in the fourth slot moved on to the next
+     * header. The words end up in rodata, so building them costs nothing at
+     * run time and they can be sent to the FIFO straight from there:
+     *
+     *     struct marker : static_list<
+     *         static_diffuse_ambient<make_rgb(31, 0, 0), make_rgb(10, 10, 10), true>,
+     *         static_cmd<gfx_begin, gl_quads>,
+     *         static_vertex<0, 0, 0>,
+     *         static_vertex<4096, 0, 0>,
+     *         static_vertex<4096, 4096, 0>,
+     *         static_vertex<0, 4096, 0>
+     *     > {};
+     *
+     *     marker::draw();        // DMA from rodata
+     *     marker::submit(queue); // the same without waiting, see dma_queue.h
+     *     writer << marker();    // or copy into a runtime list
+     *
+     * Everything in the list is written as is: nothing is batched, elided or
+     * compacted the way disp_writer does with its runtime input. The list
+     * doesn't touch the matrix stack either, so the caller has to set up the
+     * transformation before drawing it.
+     */
+
+    template <uint32_t... Words>
+    struct word_list {};
+
+    namespace detail {
+        template <typename... Cmds>
+        struct cmd_seq {};
+
+        template <typename... Lists>
+        struct join_words;
+
+        template <>
+        struct join_words<> {
+            typedef word_list<> type;
+        };
+
+        template <uint32_t... A>
+        struct join_words<word_list<A...>> {
+            typedef word_list<A...> type;
+        };
+
+        template <uint32_t... A, uint32_t... B, typename... Rest>
+        struct join_words<word_list<A...>, word_list<B...>, Rest...>
+            : join_words<word_list<A..., B...>, Rest...> {};
+
+        template <typename... Seqs>
+        struct join_cmds;
+
+        template <>
+        struct join_cmds<> {
+            typedef cmd_seq<> type;
+        };
+
+        template <typename... A>
+        struct join_cmds<cmd_seq<A...>> {
+            typedef cmd_seq<A...> type;
+        };
+
+        template <typename... A, typename... B, typename... Rest>
+        struct join_cmds<cmd_seq<A...>, cmd_seq<B...>, Rest...>
+            : join_cmds<cmd_seq<A..., B...>, Rest...> {};
+    }
+
+    // A single command and its parameters.
+    template <gfx_offset_t Cmd, uint32_t... Params>
+    struct static_cmd {
+        static constexpr gfx_offset_t offset = Cmd;
+        static constexpr size_t pcount = sizeof...(Params);
+        typedef word_list<Params...> params;
+        typedef detail::cmd_seq<static_cmd> commands;
+    };
+
+    // Several commands (or other sequences) in a row.
+    template <typename... Items>
+    struct static_seq {
+        typedef typename detail::join_cmds<typename Items::commands...>::type commands;
+    };
+
+    template <int16_t X, int16_t Y, int16_t Z>
+    struct static_vertex
+        : static_cmd<gfx_vertex16,
+                     (uint32_t(X) & 0xFFFF) | (uint32_t(Y) << 16),
+                     uint32_t(Z) & 0xFFFF> {};
+
+    template <rgb Diffuse, rgb Ambient, bool SetVertexColor>
+    struct static_diffuse_ambient
+        : static_cmd<gfx_diffuse_ambient,
+                     Diffuse | (uint32_t(Ambient) << 16) | ((SetVertexColor ? 1 : 0) << 15)> {};
+
+    template <rgb Specular, rgb Emission, bool EnableShininessTable>
+    struct static_specular_emission
+        : static_cmd<gfx_specular_emission,
+                     Specular | (uint32_t(Emission) << 16) | ((EnableShininessTable ? 1 : 0) << 15)> {};
+
+    template <uint32_t Packed>
+    struct static_normal : static_cmd<gfx_normal, Packed> {};
+
+    namespace detail {
+        typedef static_cmd<gfx_nop, 0> padding_nop;
+
+        // Writes out one header and the parameters of the four commands in
+        // it; see disp_writer::flush_pipe.
+        template <typename A, typename B, typename C, typename D>
+        struct flush_words {
+            typedef typename join_words<
+                word_list<fifo_pack(A::offset, B::offset, C::offset, D::offset)>,
+                typename A::params, typename B::params,
+                typename C::params, typename D::params>::type type;
+        };
+
+        // Packs the commands in Rest into Out. Pipe holds the commands that
+        // have been taken but not yet written, at most four.
+        template <typename Out, typename Pipe, typename Rest>
+        struct pack;
+
+        // all done
+        template <typename Out>
+        struct pack<Out, cmd_seq<>, cmd_seq<>> {
+            typedef Out type;
+        };
+
+        // fill the pipe
+        template <typename Out, typename Next, typename... Rest>
+        struct pack<Out, cmd_seq<>, cmd_seq<Next, Rest...>>
+            : pack<Out, cmd_seq<Next>, cmd_seq<Rest...>> {};
+
+        template <typename Out, typename A, typename Next, typename... Rest>
+        struct pack<Out, cmd_seq<A>, cmd_seq<Next, Rest...>>
+            : pack<Out, cmd_seq<A, Next>, cmd_seq<Rest...>> {};
+
+        template <typename Out, typename A, typename B, typename Next, typename... Rest>
+        struct pack<Out, cmd_seq<A, B>, cmd_seq<Next, Rest...>>
+            : pack<Out, cmd_seq<A, B, Next>, cmd_seq<Rest...>> {};
+
+        template <typename Out, typename A, typename B, typename C, typename Next, typename... Rest>
+        struct pack<Out, cmd_seq<A, B, C>, cmd_seq<Next, Rest...>>
+            : pack<Out, cmd_seq<A, B, C, Next>, cmd_seq<Rest...>> {};
+
+        // pad a partial pipe at the end
+        template <typename Out, typename A>
+        struct pack<Out, cmd_seq<A>, cmd_seq<>>
+            : pack<Out, cmd_seq<A, padding_nop, padding_nop, padding_nop>, cmd_seq<>> {};
+
+        template <typename Out, typename A, typename B>
+        struct pack<Out, cmd_seq<A, B>, cmd_seq<>>
+            : pack<Out, cmd_seq<A, B, padding_nop, padding_nop>, cmd_seq<>> {};
+
+        template <typename Out, typename A, typename B, typename C>
+        struct pack<Out, cmd_seq<A, B, C>, cmd_seq<>>
+            : pack<Out, cmd_seq<A, B, C, padding_nop>, cmd_seq<>> {};
+
+        // A full pipe gets written out, except that the top-most command
+        // must have parameters, so a parameterless one waits for the next
+        // header.
+        template <bool Defer, typename Out, typename A, typename B, typename C, typename D, typename Rest>
+        struct flush_full;
+
+        template <typename Out, typename A, typename B, typename C, typename D, typename Rest>
+        struct flush_full<false, Out, A, B, C, D, Rest>
+            : pack<typename join_words<Out, typename flush_words<A, B, C, D>::type>::type,
+                   cmd_seq<>, Rest> {};
+
+        template <typename Out, typename A, typename B, typename C, typename D, typename Rest>
+        struct flush_full<true, Out, A, B, C, D, Rest>
+            : pack<typename join_words<Out, typename flush_words<A, B, C, padding_nop>::type>::type,
+                   cmd_seq<D>, Rest> {};
+
+        template <typename Out, typename A, typename B, typename C, typename D, typename... Rest>
+        struct pack<Out, cmd_seq<A, B, C, D>, cmd_seq<Rest...>>
+            : flush_full<D::pcount == 0, Out, A, B, C, D, cmd_seq<Rest...>> {};
+    }
+
+    template <typename Words>
+    struct word_array;
+
+    template <uint32_t... Words>
+    struct word_array<word_list<Words...>> {
+        static constexpr size_t size = sizeof...(Words);
+        static constexpr uint32_t data[sizeof...(Words)] = { Words... };
+    };
+
+    template <uint32_t... Words>
+    constexpr size_t word_array<word_list<Words...>>::size;
+    template <uint32_t... Words>
+    constexpr uint32_t word_array<word_list<Words...>>::data[sizeof...(Words)];
+
+    // Sends the packed words to the geometry engine FIFO by DMA. Defined in
+    // display_list.cpp.
+    void draw_words(uint32_t const* words, size_t count);
+
+    template <typename... Items>
+    struct static_list
+        : word_array<typename detail::pack<
+            word_list<>, detail::cmd_seq<>, typename static_seq<Items...>::commands>::type>
+    {
+        static void draw() {
+            draw_words(static_list::data, static_list::size);
+        }
+
+        static void submit(dma_queue& queue) {
+            queue.submit(static_list::data, static_list::size);
+        }
+    };
+}
+
+#endif // ROADS_STATIC_LIST_H
@@ -0,0 +1,113 @@
+#include "strip_builder.h"
+
+namespace roads
+{
+    namespace
+    {
+        vector3f16 const& corner(strip_builder::face const& f, unsigned rotation, unsigned k)
+        {
+            return f.v[(k + rotation) & 3];
+        }
+
+        uint64_t key(vector3f16 const& v)
+        {
+            return uint64_t(uint16_t(raw(v.x)))
+                | (uint64_t(uint16_t(raw(v.y))) << 16)
+                | (uint64_t(uint16_t(raw(v.z))) << 32);
+        }
+
+        bool same_state(strip_builder::face const& a, strip_builder::face const& b)
+        {
+            if(a.valid != b.valid)
+                return false;
+            for(unsigned k = 0; k < 4; ++k) {
+                if((a.valid & (1u << k)) && a.state[k] != b.state[k])
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    void strip_builder::build()
+    {
+        size_t const n = face_list.size();
+        run_list.clear();
+        vertex_list.clear();
+        strip_runs.clear();
+        used.assign(n, false);
+        keys.resize(4 * n);
+        for(size_t i = 0; i < n; ++i) {
+            for(unsigned k = 0; k < 4; ++k)
+                keys[4 * i + k] = key(face_list[i].v[k]);
+        }
+
+        // Finds an unused face that starts with the d, c edge of face i
+        // turned by rotation, and the rotation that makes it do so.
+        auto find_next = [&](size_t i, unsigned rotation, size_t& next, unsigned& next_rotation) {
+            uint64_t const c = keys[4 * i + ((rotation + 2) & 3)];
+            uint64_t const d = keys[4 * i + ((rotation + 3) & 3)];
+            for(size_t j = 0; j < n; ++j) {
+                if(used[j])
+                    continue;
+                uint64_t const* const other = &keys[4 * j];
+                for(unsigned s = 0; s < 4; ++s) {
+                    if(other[s] == d && other[(s + 1) & 3] == c && same_state(face_list[i], face_list[j])) {
+                        next = j;
+                        next_rotation = s;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+
+        // Single quads go straight into run_list; strips are collected in
+        // strip_runs and appended after them.
+        for(size_t i = 0; i < n; ++i) {
+            if(used[i])
+                continue;
+            used[i] = true;
+
+            face const& f = face_list[i];
+            size_t next = 0;
+            unsigned rotation = 0, next_rotation = 0;
+            bool joined = false;
+            for(; rotation < 4 && !joined; ++rotation)
+                joined = find_next(i, rotation, next, next_rotation);
+
+            size_t const first = vertex_list.size();
+            if(!joined) {
+                for(unsigned k = 0; k < 4; ++k)
+                    vertex_list.push_back(f.v[k]);
+                run const single = { i, first, 1 };
+                run_list.push_back(single);
+                continue;
+            }
+
+            --rotation;
+            vertex_list.push_back(corner(f, rotation, 0));
+            vertex_list.push_back(corner(f, rotation, 1));
+            vertex_list.push_back(corner(f, rotation, 3));
+            vertex_list.push_back(corner(f, rotation, 2));
+
+            size_t count = 1;
+            size_t current = next;
+            unsigned current_rotation = next_rotation;
+            for(;;) {
+                used[current] = true;
+                vertex_list.push_back(corner(face_list[current], current_rotation, 3));
+                vertex_list.push_back(corner(face_list[current], current_rotation, 2));
+                ++count;
+                if(!find_next(current, current_rotation, next, next_rotation))
+                    break;
+                current = next;
+                current_rotation = next_rotation;
+            }
+
+            run const strip = { i, first, count };
+            strip_runs.push_back(strip);
+        }
+
+        run_list.insert(run_list.end(), strip_runs.begin(), strip_runs.end());
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef ROADS_STRIP_BUILDER_H
+#define ROADS_STRIP_BUILDER_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+#include "fixed16.h"
+#include "vector.h"
+
+namespace roads {
+    /*
+     * Collects quads and joins the ones that share an edge into quad strips,
+     * so that the shared edge is sent once instead of twice. A disp_writer
+     * given a strip_builder with set_strip_builder holds back its quads until
+     * the end of the list and then writes them through build().
+     *
+     * Quads are only joined when they were written with the same normal and
+     * material, since the vertices of the shared edge are lit once for both.
+     * Each face keeps the winding it was written with: the strip visits its
+     * quads in the order a, b, d, c, so the next quad must start with the
+     * previous one's d and c.
+     */
+    struct strip_builder {
+        struct face {
+            vector3f16 v[4];
+            // The state the quad was written with, as in disp_writer's
+            // shadow_state; only values whose bit is set in valid matter.
+            uint32_t state[4];
+            unsigned valid;
+        };
+
+        // A strip of count faces, or a single quad if count is 1. Its
+        // vertices are vertices()[first_vertex..] in the order to send them;
+        // the state is that of faces()[face].
+        struct run {
+            size_t face, first_vertex, count;
+        };
+
+        void clear() {
+            face_list.clear();
+        }
+
+        size_t size() const { return face_list.size(); }
+
+        // Forgets the faces added after the first count, for rolling back.
+        void truncate(size_t count) {
+            face_list.resize(count);
+        }
+
+        void add(face const& f) {
+            face_list.push_back(f);
+        }
+
+        // Chains the faces into runs, single quads first (so that they can
+        // share one gfx_begin) and then the strips, each in the order its
+        // first face was added.
+        void build();
+
+        std::vector<face> const& faces() const { return face_list; }
+        std::vector<run> const& runs() const { return run_list; }
+        std::vector<vector3f16> const& vertices() const { return vertex_list; }
+
+    private:
+        std::vector<face> face_list;
+        std::vector<run> run_list;
+        std::vector<vector3f16> vertex_list;
+        std::vector<run> strip_runs;
+        std::vector<bool> used;
+        // the corners of every face, packed for quick comparison
+        std::vector<uint64_t> keys;
+    };
+}
+
+#endif // ROADS_STRIP_BUILDER_H
@@ -10,10 +10,11 @@
 
 namespace roads
 {
-    void unit_test_suite::run_tests()
+    size_t unit_test_suite::run_tests()
     {
         typedef std::vector<unit_test_base*> testvec;
         testvec::const_iterator begin = m_tests.begin(), end = m_tests.end();
+        size_t failures = 0;
 
         for(;begin != end; ++begin)
         {
@@ -27,8 +28,11 @@ namespace roads
             catch(unit_test_failure& failure)
             {
                 iprintf("[FAILED: %s]\n\tReason: %s\n", test.name().c_str(), failure.what());
+                ++failures;
             }
         }
+
+        return failures;
     }
     unit_test_suite::~unit_test_suite()
     {
@@ -37,7 +37,8 @@ namespace roads
             m_tests.push_back(test.release());
         }
 
-        void run_tests();
+        // Returns the number of tests that failed.
+        size_t run_tests();
         ~unit_test_suite();
 
     private: